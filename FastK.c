@@ -11,6 +11,8 @@
  *
  *********************************************************************************************/
  
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +21,9 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sched.h>
 #include <math.h>
 #include <time.h>
 
@@ -32,7 +37,8 @@ int    DO_STAGE;   //  Which step to perform
 #endif
 
 static char *Usage[] = { "[-k<int(40)>] -t[<int(4)>]] [-p[:<table>[.ktab]]] [-c] [-bc<int(0)>]",
-                         "  [-v] [-N<path_name>] [-P<dir(/tmp)>] [-M<int(12)>] [-T<int(4)>]",
+                         "  [-v] [-N<path_name>] [-P<dir(/tmp)> ...] [-Z] [-S<scheme>[.scheme]]",
+                         "  [-s<int>/<int>] [-R] [-D<int>] [-M<int(12)>] [-T<int(4)>] [-Ti<int>] [-To<int>]",
                          "    <source>[.cram|.[bs]am|.db|.dam|.f[ast][aq][.gz] ..."
                        };
 
@@ -41,8 +47,13 @@ static char *Usage[] = { "[-k<int(40)>] -t[<int(4)>]] [-p[:<table>[.ktab]]] [-c]
 int    VERBOSE;      //  show progress
 int    NTHREADS;     //  # of threads to run with
 int      ITHREADS;     //  # of threads possible for input
+int    IO_THREADS;   //  # of threads to read the input with (-Ti, NTHREADS if not given)
+int    NTABLES;      //  # of parts of the k-mer table (-To, NTHREADS if not given)
 int64  SORT_MEMORY;  //  GB of memory for downstream KMcount sorts
 char  *SORT_PATH;    //  where to put external files
+int    NSORTS;       //  # of directories to stripe the part files over
+char **SORT_PATHS;   //  [i] for i in [0,NSORTS) = i'th such directory
+int    SORT_PLEN;    //  length of the longest of these paths
 
 int    KMER;         //  desired K-mer length
 int    DO_TABLE;     // Zero or table cutoff
@@ -51,11 +62,20 @@ Kmer_Stream *PRO_TABLE;   //  Kmer stream of profile option (only if relative pr
 char        *PRO_NAME;    //  Name of profile table
 int    BC_PREFIX;    // Ignore prefix of each sequence of this length
 char  *OUT_NAME;     // Prefix root for all output file names
+char  *SCHEME;       // Minimizer scheme file to reuse or save
+int    SHARD;        // If > 0 then count only the parts of shard SHARD of NSHARDS
+int    NSHARDS;
 int    COMPRESS;     // Homopoloymer compress input
+int    ZIP_SMERS;    // Compress super-mer files in SORT_PATH
+int64  DISK_BUDGET;  // Max bytes of super-mer files at any one time (0 => no limit)
+int    RESUME;       // Checkpoint the run and resume it from its checkpoint if there is one
 
   //  Major parameters, sizes of things
 
 int    NPARTS;       //  # of k-mer buckets to use
+int    PASS_BEG;     //  Buckets distributed & sorted in the current pass over the input
+int    PASS_END;
+int    IN_CORE;      //  Keep super-mer lists in memory (NPARTS == 1)
 int    SMER;         //  size of a super-mer for sorts
 int64  KMAX;         //  max k-mers in any part
 int64  NMAX;         //  max super-mers in any part
@@ -178,13 +198,423 @@ static char *PATH;
 static char *ROOT;
 static Input_Partition *IOPACK;
 
+  //  The files of each part and thread are assigned to a -P directory by a cyclic map in which
+  //    each directory occurs in proportion to its free space at the start of the run.
+
+static int  SORT_MAPLEN;
+static int *SORT_MAP;
+
+char *Sort_Path(int part, int thread)
+{ return (SORT_PATHS[SORT_MAP[(part*NTHREADS + thread) % SORT_MAPLEN]]); }
+
+  //  A single read or write transfers at most 0x7ffff000 bytes on Linux (and less on a signal
+  //    or pipe), so I/O on buffers sized from -M loops until all len bytes are moved.  Read_All
+  //    returns fewer than len bytes only at end of file, and both return -1 on an error.
+
+int64 Read_All(int fd, void *buf, int64 len)
+{ uint8 *b = (uint8 *) buf;
+  int64  n, x;
+
+  for (n = 0; n < len; n += x)
+    { x = read(fd,b+n,len-n);
+      if (x == 0)
+        break;
+      if (x < 0)
+        return (-1);
+    }
+  return (n);
+}
+
+int64 Write_All(int fd, void *buf, int64 len)
+{ uint8 *b = (uint8 *) buf;
+  int64  n, x;
+
+  for (n = 0; n < len; n += x)
+    { x = write(fd,b+n,len-n);
+      if (x <= 0)
+        return (-1);
+    }
+  return (n);
+}
+
+ /********************************************************************************************
+ *
+ *  NUMA PLACEMENT
+ *    If the CPUs the process may run on span more than one memory node, then each sort
+ *    thread t in [0,NTHREADS) is assigned a node, in proportion to the number of CPUs of
+ *    each node, and Pin_Thread(t) restricts the calling thread to the CPUs of that node.
+ *    The sort arrays are first touched by pinned threads in the same panels the sorts later
+ *    work on, so that the kernel's first-touch policy places each panel on the node of the
+ *    thread that sorts it.  Unpin_Thread() returns the calling thread to the CPUs the
+ *    process started with.  With one node (or if NUMA_PIN is undefined) both are no-ops.
+ *
+ *********************************************************************************************/
+
+#define NUMA_PIN    //  Pin sort threads to the nodes their panels are placed on
+
+int NUMA_NODES = 1;   //  # of memory nodes the sort threads are spread over
+
+#if defined(NUMA_PIN) && defined(__linux__)
+
+static cpu_set_t  Proc_Set;     //  CPUs of the process at start up
+static cpu_set_t *Node_Set;     //  [t] = CPUs of the node of sort thread t
+
+  //  Read a sysfs cpu list such as "0-3,8-11" into set
+
+static int read_cpulist(char *name, cpu_set_t *set)
+{ FILE *f;
+  int   a, b, c;
+
+  CPU_ZERO(set);
+  f = fopen(name,"r");
+  if (f == NULL)
+    return (0);
+  while (fscanf(f,"%d",&a) == 1)
+    { b = a;
+      c = fgetc(f);
+      if (c == '-')
+        { if (fscanf(f,"%d",&b) != 1)
+            break;
+          c = fgetc(f);
+        }
+      for ( ; a <= b; a++)
+        if (a < CPU_SETSIZE)
+          CPU_SET(a,set);
+      if (c != ',')
+        break;
+    }
+  fclose(f);
+  return (1);
+}
+
+static void setup_placement()
+{ cpu_set_t *node, mask;
+  DIR       *dirp;
+  struct dirent *dp;
+  char       name[100];
+  int        nnode, ncpu, *cnode;
+  int        n, c, i, t;
+
+  if (sched_getaffinity(0,sizeof(cpu_set_t),&Proc_Set) != 0)
+    return;
+
+  dirp = opendir("/sys/devices/system/node");
+  if (dirp == NULL)
+    return;
+  nnode = 0;
+  while ((dp = readdir(dirp)) != NULL)
+    if (sscanf(dp->d_name,"node%d",&n) == 1 && n >= nnode)
+      nnode = n+1;
+  closedir(dirp);
+  if (nnode <= 1)
+    return;
+
+  //  Intersect the CPUs of each node with those of the process, and list the usable CPUs
+  //    in node order (cnode[i] = node of the i'th such CPU)
+
+  node  = (cpu_set_t *) Malloc(sizeof(cpu_set_t)*nnode,"Allocating node map");
+  cnode = (int *) Malloc(sizeof(int)*CPU_SETSIZE,"Allocating node map");
+  if (node == NULL || cnode == NULL)
+    exit (1);
+
+  ncpu  = 0;
+  NUMA_NODES = 0;
+  for (n = 0; n < nnode; n++)
+    { sprintf(name,"/sys/devices/system/node/node%d/cpulist",n);
+      if ( ! read_cpulist(name,&mask))
+        CPU_ZERO(&mask);
+      CPU_AND(node+n,&mask,&Proc_Set);
+      c = CPU_COUNT(node+n);
+      if (c > 0)
+        NUMA_NODES += 1;
+      for (i = 0; i < c; i++)
+        cnode[ncpu++] = n;
+    }
+
+  if (NUMA_NODES > 1)
+    { Node_Set = (cpu_set_t *) Malloc(sizeof(cpu_set_t)*NTHREADS,"Allocating node map");
+      if (Node_Set == NULL)
+        exit (1);
+      for (t = 0; t < NTHREADS; t++)
+        Node_Set[t] = node[cnode[((2*t+1)*ncpu)/(2*NTHREADS)]];
+    }
+  else
+    NUMA_NODES = 1;
+
+  free(cnode);
+  free(node);
+}
+
+void Pin_Thread(int t)
+{ if (NUMA_NODES > 1)
+    sched_setaffinity(0,sizeof(cpu_set_t),Node_Set+t);
+}
+
+void Unpin_Thread()
+{ if (NUMA_NODES > 1)
+    sched_setaffinity(0,sizeof(cpu_set_t),&Proc_Set);
+}
+
+#else
+
+static void setup_placement() { }
+
+void Pin_Thread(int t)
+{ (void) t; }
+
+void Unpin_Thread() { }
+
+#endif
+
+ /********************************************************************************************
+ *
+ *  CHECKPOINTS
+ *    The checkpoint file SORT_PATH/<root>.ckpt consists of 21 int's: the # of phases and
+ *    parts completed, the options and sizes that must agree on resumption, and the sizes
+ *    determined by phases 1 & 2; followed by the int64's KMAX, NMAX, max_inst, tmers, and
+ *    a signature of the names, sizes, and modification times of the inputs, then NUM_RID, the histogram counts, the table split, the k-mers of each part, and
+ *    lastly the map of the part files to the -P directories.
+ *
+ *********************************************************************************************/
+
+Checkpoint *CHECKPOINT;
+
+static char *CKPT_NAME;
+static int64 INPUT_SIG;
+
+  //  A hash of the names, sizes, and modification times of the input files so that a run is
+  //    not resumed on inputs other than those of its checkpoint
+
+static int64 input_signature(int argc, char *argv[])
+{ struct stat st;
+  uint64      h;
+  int64       v[2];
+  uint8      *b;
+  int         i, j;
+
+  h = 0xcbf29ce484222325ull;
+  for (i = 1; i < argc; i++)
+    { for (b = (uint8 *) argv[i]; *b != '\0'; b++)
+        h = (h ^ *b) * 0x100000001b3ull;
+      if (stat(argv[i],&st) == 0)
+        { v[0] = st.st_size;
+          v[1] = st.st_mtime;
+        }
+      else
+        v[0] = v[1] = -1;
+      b = (uint8 *) v;
+      for (j = 0; j < (int) sizeof(v); j++)
+        h = (h ^ b[j]) * 0x100000001b3ull;
+    }
+  return ((int64) h);
+}
+
+static void alloc_checkpoint()
+{ CHECKPOINT->split  = Malloc(sizeof(int)*NTABLES,"Allocating checkpoint");
+  CHECKPOINT->wkmers = Malloc(sizeof(int64)*2*NPARTS,"Allocating checkpoint");
+  if (CHECKPOINT->split == NULL || CHECKPOINT->wkmers == NULL)
+    Clean_Exit(1);
+  CHECKPOINT->ukmers = CHECKPOINT->wkmers + NPARTS;
+}
+
+static void free_checkpoint()
+{ if (CHECKPOINT->split != NULL)
+    { free(CHECKPOINT->wkmers);
+      free(CHECKPOINT->split);
+    }
+  free(CHECKPOINT);
+  free(CKPT_NAME);
+  CHECKPOINT = NULL;
+}
+
+  //  Record that the given phase (and CHECKPOINT->parts parts of phase 2) is complete.  The
+  //    file is written to a temporary and then renamed so a checkpoint is never partial.
+
+void Save_Checkpoint(int phase)
+{ Checkpoint *c = CHECKPOINT;
+  int         head[21];
+  int64       size[5];
+  char       *temp;
+  FILE       *f;
+
+  c->phase = phase;
+  if (phase == 1 && c->parts == 0)
+    { bzero(c->counts,sizeof(int64)*0x8000);
+      c->max_inst = 0;
+      c->tmers    = 0;
+    }
+
+  head[0]  = c->phase;
+  head[1]  = c->parts;
+  head[2]  = KMER;
+  head[3]  = NTHREADS;
+  head[4]  = ITHREADS;
+  head[5]  = NPARTS;
+  head[6]  = MAX_SUPER;
+  head[7]  = DO_TABLE;
+  head[8]  = DO_PROFILE;
+  head[9]  = (PRO_TABLE != NULL);
+  head[10] = COMPRESS;
+  head[11] = BC_PREFIX;
+  head[12] = ZIP_SMERS;
+  head[13] = SHARD;
+  head[14] = NSHARDS;
+  head[15] = KMAX_BYTES;
+  head[16] = RUN_BITS;
+  head[17] = IDX_BYTES;
+  head[18] = NSORTS;
+  head[19] = SORT_MAPLEN;
+  head[20] = NTABLES;
+
+  size[0] = KMAX;
+  size[1] = NMAX;
+  size[2] = c->max_inst;
+  size[3] = c->tmers;
+  size[4] = INPUT_SIG;
+
+  temp = Malloc(strlen(CKPT_NAME)+20,"Allocating checkpoint name");
+  if (temp == NULL)
+    Clean_Exit(1);
+  sprintf(temp,"%s.%d",CKPT_NAME,getpid());
+
+  f = fopen(temp,"w");
+  if (f == NULL)
+    { fprintf(stderr,"\n%s: Cannot create checkpoint %s\n",Prog_Name,CKPT_NAME);
+      Clean_Exit(1);
+    }
+  fwrite(head,sizeof(int),21,f);
+  fwrite(size,sizeof(int64),5,f);
+  fwrite(NUM_RID,sizeof(int64),ITHREADS,f);
+  fwrite(c->counts,sizeof(int64),0x8000,f);
+  fwrite(c->split,sizeof(int),NTABLES,f);
+  fwrite(c->wkmers,sizeof(int64),2*NPARTS,f);
+  fwrite(SORT_MAP,sizeof(int),SORT_MAPLEN,f);
+  if (fclose(f) != 0 || rename(temp,CKPT_NAME) != 0)
+    { fprintf(stderr,"\n%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,CKPT_NAME);
+      unlink(temp);
+      Clean_Exit(1);
+    }
+  free(temp);
+}
+
+  //  If there is a checkpoint then check that it is for a run with the same options and
+  //    restore the sizes and state it records, returning the # of phases completed.
+
+static int load_checkpoint()
+{ Checkpoint *c = CHECKPOINT;
+  int         head[21];
+  int64       size[5];
+  FILE       *f;
+  int         i;
+
+  f = fopen(CKPT_NAME,"r");
+  if (f == NULL)
+    return (0);
+
+  if (fread(head,sizeof(int),21,f) != 21 || fread(size,sizeof(int64),5,f) != 5)
+    goto bad_checkpoint;
+  if (head[0] < 1 || head[0] > 3 || head[5] <= 0 || head[1] < 0 || head[1] > head[5]
+                  || head[19] <= 0)
+    goto bad_checkpoint;
+
+  if (head[2] != KMER || head[3] != NTHREADS || head[4] != ITHREADS || head[7] != DO_TABLE
+      || head[8] != DO_PROFILE || head[9] != (PRO_TABLE != NULL) || head[10] != COMPRESS
+      || head[11] != BC_PREFIX || head[12] != ZIP_SMERS || head[13] != SHARD
+      || head[14] != NSHARDS || head[18] != NSORTS || head[20] != NTABLES)
+    { fprintf(stderr,"\n%s: Checkpoint %s is of a run with different options\n",
+                     Prog_Name,CKPT_NAME);
+      fclose(f);
+      ROOT = NULL;      //  Leave the files of the checkpointed run alone
+      Clean_Exit(1);
+    }
+  if (size[4] != INPUT_SIG)
+    { fprintf(stderr,"\n%s: Checkpoint %s is of a run on different or modified inputs\n",
+                     Prog_Name,CKPT_NAME);
+      fclose(f);
+      ROOT = NULL;
+      Clean_Exit(1);
+    }
+
+  c->phase   = head[0];
+  c->parts   = head[1];
+  NPARTS     = head[5];
+  MAX_SUPER  = head[6];
+  KMAX_BYTES = head[15];
+  RUN_BITS   = head[16];
+  RUN_BYTES  = (RUN_BITS+7) >> 3;
+  IDX_BYTES  = head[17];
+
+  KMAX        = size[0];
+  NMAX        = size[1];
+  c->max_inst = size[2];
+  c->tmers    = size[3];
+
+  NUM_RID = Malloc(sizeof(int64)*ITHREADS,"Allocating checkpoint");
+  if (NUM_RID == NULL)
+    Clean_Exit(1);
+  alloc_checkpoint();
+
+  if (fread(NUM_RID,sizeof(int64),ITHREADS,f) != (size_t) ITHREADS
+      || fread(c->counts,sizeof(int64),0x8000,f) != 0x8000
+      || fread(c->split,sizeof(int),NTABLES,f) != (size_t) NTABLES
+      || fread(c->wkmers,sizeof(int64),2*NPARTS,f) != (size_t) (2*NPARTS))
+    goto bad_checkpoint;
+
+  //  The part files are where the checkpointed run put them, whatever the free space is now
+
+  SORT_MAPLEN = head[19];
+  SORT_MAP    = Realloc(SORT_MAP,sizeof(int)*SORT_MAPLEN,"Allocating checkpoint");
+  if (SORT_MAP == NULL)
+    Clean_Exit(1);
+  if (fread(SORT_MAP,sizeof(int),SORT_MAPLEN,f) != (size_t) SORT_MAPLEN)
+    goto bad_checkpoint;
+  for (i = 0; i < SORT_MAPLEN; i++)
+    if (SORT_MAP[i] < 0 || SORT_MAP[i] >= NSORTS)
+      goto bad_checkpoint;
+  fclose(f);
+
+  return (c->phase);
+
+bad_checkpoint:
+  fprintf(stderr,"\n%s: %s is not a valid checkpoint file\n",Prog_Name,CKPT_NAME);
+  fclose(f);
+  ROOT = NULL;
+  Clean_Exit(1);
+  return (0);
+}
+
+  //  The run is complete: remove the checkpoint and the files whose removal it deferred
+
+static void remove_checkpoint()
+{ char *command;
+  int   i;
+
+  command = Malloc(SORT_PLEN + strlen(ROOT) + 100,"Command string");
+  if (command == NULL)
+    Clean_Exit(1);
+  for (i = 0; i < NSORTS; i++)
+    { sprintf(command,"rm -f %s/%s.*.[TLP]*",SORT_PATHS[i],ROOT);
+      system(command);
+    }
+  unlink(CKPT_NAME);
+  free(command);
+
+  free_checkpoint();
+}
+
 void Clean_Exit(int status)
 { char *command;
+  int   i;
 
   fprintf(stderr,"\n*** Error Exit %d ***\n",status);
 
+  if (CHECKPOINT != NULL && CHECKPOINT->phase > 0)
+    { fprintf(stderr,"\n   Rerun with -R to resume from checkpoint %s\n",CKPT_NAME);
+      ROOT = NULL;
+    }
+
   if (ROOT != NULL)
-    { command = Malloc(3*strlen(ROOT) + 3*strlen(PATH) + strlen(SORT_PATH) + 500,"Command string");
+    { command = Malloc(3*strlen(ROOT) + 3*strlen(PATH) + SORT_PLEN + 500,"Command string");
       if (command == NULL)
         goto could_not;
 
@@ -198,16 +628,17 @@ void Clean_Exit(int status)
       if (system(command) != 0)
         goto could_not;
 
-      sprintf(command,"rm -f %s/%s.*.[TLP]*",SORT_PATH,ROOT);
-      system(command);
-      if (system(command) != 0)
-        goto could_not;
-
-      sprintf(command,"Fastrm -f %s/%s.U*.ktab",SORT_PATH,ROOT);
-      system(command);
-      if (system(command) != 0)
-        goto could_not;
+      for (i = 0; i < NSORTS; i++)
+        { sprintf(command,"rm -f %s/%s.*.[TLP]*",SORT_PATHS[i],ROOT);
+          system(command);
+          if (system(command) != 0)
+            goto could_not;
 
+          sprintf(command,"Fastrm -f %s/%s.U*.ktab",SORT_PATHS[i],ROOT);
+          system(command);
+          if (system(command) != 0)
+            goto could_not;
+        }
     }
 
   if (IOPACK != NULL)
@@ -221,26 +652,38 @@ could_not:
 }
 
 int main(int argc, char *argv[])
-{ 
+{ int phase;    //  # of phases already completed according to the checkpoint (if -R)
+
   startTime();
 
   { int    i, j, k;
     int    flags[128];
     int    memory; 
+    int    budget;
     char  *eptr;
 
     ARG_INIT("FastK")
 
+    SORT_PATHS = (char **) Malloc(sizeof(char *)*(argc+1),"Allocating directory list");
+    if (SORT_PATHS == NULL)
+      exit (1);
+
     KMER        = 40;
     SORT_MEMORY = 12000000000ll;
     NTHREADS    = 4;
-    SORT_PATH   = "/tmp";
+    IO_THREADS  = 0;
+    NTABLES     = 0;
+    NSORTS      = 0;
+    DISK_BUDGET = 0;
     DO_TABLE    = 0;
     DO_PROFILE  = 0;
       PRO_TABLE   = NULL;
       PRO_NAME    = NULL;
     BC_PREFIX   = 0;
     OUT_NAME    = NULL;
+    SCHEME      = NULL;
+    SHARD       = 0;
+    NSHARDS     = 0;
 #ifdef DEVELOPER
     DO_STAGE    = 0;
 #endif
@@ -250,7 +693,7 @@ int main(int argc, char *argv[])
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("vcpt")
+            ARG_FLAGS("vcptZR")
             break;
           case 'b':
             if (argv[i][2] != 'c')
@@ -266,7 +709,7 @@ int main(int argc, char *argv[])
             break;
           case 'p':
             if (argv[i][2] != ':')
-              { ARG_FLAGS("vcpt");
+              { ARG_FLAGS("vcptZR");
                 break;
               }
             PRO_NAME  = argv[i]+3;
@@ -279,11 +722,15 @@ int main(int argc, char *argv[])
             break;
           case 't':
             if (argv[i][2] == '\0' || isalpha(argv[i][2]))
-              { ARG_FLAGS("vcpt");
+              { ARG_FLAGS("vcptZR");
                 break;
               }
             ARG_POSITIVE(DO_TABLE,"Cutoff for k-mer table")
             break;
+          case 'D':
+            ARG_POSITIVE(budget,"GB of disk for super-mer files")
+            DISK_BUDGET = budget * 1000000000ll;
+            break;
           case 'M':
             ARG_POSITIVE(memory,"GB of memory for sorting step")
             SORT_MEMORY = memory * 1000000000ll;
@@ -292,10 +739,34 @@ int main(int argc, char *argv[])
             OUT_NAME = argv[i]+2;
             break;
           case 'P':
-            SORT_PATH = argv[i]+2;
+            SORT_PATHS[NSORTS++] = argv[i]+2;
+            break;
+          case 's':
+            SHARD = strtol(argv[i]+2,&eptr,10);
+            if (eptr > argv[i]+2 && *eptr == '/')
+              NSHARDS = strtol(eptr+1,&eptr,10);
+            if (*eptr != '\0' || NSHARDS <= 0 || SHARD <= 0 || SHARD > NSHARDS)
+              { fprintf(stderr,"%s: -s '%s' argument is not of the form <i>/<n> with 1 <= i <= n\n",
+                               Prog_Name,argv[i]+2);
+                exit (1);
+              }
+            break;
+          case 'S':
+            SCHEME = argv[i]+2;
             break;
           case 'T':
-            ARG_POSITIVE(NTHREADS,"Number of threads")
+            if (argv[i][2] == 'i')
+              { argv[i] += 1;
+                ARG_POSITIVE(IO_THREADS,"Number of input threads")
+                argv[i] -= 1;
+              }
+            else if (argv[i][2] == 'o')
+              { argv[i] += 1;
+                ARG_POSITIVE(NTABLES,"Number of table parts")
+                argv[i] -= 1;
+              }
+            else
+              { ARG_POSITIVE(NTHREADS,"Number of threads") }
             break;
 #ifdef DEVELOPER
           case '1':
@@ -318,11 +789,22 @@ int main(int argc, char *argv[])
 
     VERBOSE    = flags['v'];   //  Globally declared in filter.h
     COMPRESS   = flags['c'];
+#ifdef DEVELOPER
+    ZIP_SMERS  = 0;
+#else
+    ZIP_SMERS  = flags['Z'];
+#endif
+    RESUME     = flags['R'];
     if (flags['t'])
       DO_TABLE = 4;
     if (flags['p'])
       DO_PROFILE = 1;
 
+    if (IO_THREADS == 0)
+      IO_THREADS = NTHREADS;
+    if (NTABLES == 0)
+      NTABLES = NTHREADS;
+
     if (PRO_TABLE != NULL)
       { if (PRO_TABLE->kmer != KMER)
           { fprintf(stderr,"%s: -p table k-mer size (%d) != k-mer specified (%d)\n",
@@ -334,15 +816,45 @@ int main(int argc, char *argv[])
         DO_TABLE = 0;
       }
 
+    if (SHARD > 0)
+      { if (SCHEME == NULL)
+          { fprintf(stderr,"%s: -s requires a scheme file -S shared by all the shards\n",
+                           Prog_Name);
+            exit (1);
+          }
+        if (DO_PROFILE)
+          { fprintf(stderr,"%s: -s cannot be used when producing profiles (-p)\n",Prog_Name);
+            exit (1);
+          }
+      }
+
+    if (DISK_BUDGET > 0 && RESUME)
+      { fprintf(stderr,"%s: -D and -R cannot be used together\n",Prog_Name);
+        exit (1);
+      }
+
+    if (DISK_BUDGET > 0 && DO_PROFILE)
+      { fprintf(stderr,"%s: -D cannot be used when producing profiles (-p)\n",Prog_Name);
+        exit (1);
+      }
+
     if (argc < 2)
       { fprintf(stderr,"\nUsage: %s %s\n",Prog_Name,Usage[0]);
         fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[1]);
         fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[2]);
+        fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[3]);
         fprintf(stderr,"\n");
         fprintf(stderr,"      -v: Verbose mode, output statistics as proceed.\n");
         fprintf(stderr,"      -T: Use -T threads.\n");
+        fprintf(stderr,"     -Ti: Read & decompress the input with -Ti threads (default -T).\n");
+        fprintf(stderr,"     -To: Output the k-mer table in -To parts (default -T).\n");
         fprintf(stderr,"      -N: Use given path for output directory and root name prefix.\n");
         fprintf(stderr,"      -P: Place block level sorts in directory -P.\n");
+        fprintf(stderr,"      -Z: Compress the super-mer files placed in directory -P.\n");
+        fprintf(stderr,"      -S: Use the minimizer scheme in the given file, or save it there.\n");
+        fprintf(stderr,"      -s: Count only the k-mers of shard i of n (requires -S).\n");
+        fprintf(stderr,"      -R: Checkpoint the run, and resume it from its checkpoint if any.\n");
+        fprintf(stderr,"      -D: Use at most -D GB of disk for super-mer files (more input passes).\n");
         fprintf(stderr,"      -M: Use -M GB of memory in downstream sorting steps of KMcount.\n");
         fprintf(stderr,"\n");
         fprintf(stderr,"      -k: k-mer size.\n");
@@ -354,45 +866,125 @@ int main(int argc, char *argv[])
       }
   }
 
-  //  Get full path strong for sorting subdirectory (in variable SORT_PATH)
+  //  Get full path strong for each sorting subdirectory (in SORT_PATHS, the first of which
+  //    is SORT_PATH where files that are not striped are placed)
 
   { char  *cpath, *spath;
     DIR   *dirp;
-
-    if (SORT_PATH[0] != '/')
-      { cpath = getcwd(NULL,0);
-        if (SORT_PATH[0] == '.')
-          { if (SORT_PATH[1] == '/')
-              spath = Catenate(cpath,SORT_PATH+1,"","");
-            else if (SORT_PATH[1] == '\0')
-              spath = cpath;
-            else
-              { fprintf(stderr,"\n%s: -P option: . not followed by /\n",Prog_Name);
-                exit (1);
+    int    d;
+
+    if (NSORTS == 0)
+      SORT_PATHS[NSORTS++] = "/tmp";
+
+    SORT_PLEN = 0;
+    for (d = 0; d < NSORTS; d++)
+      { SORT_PATH = SORT_PATHS[d];
+        if (SORT_PATH[0] != '/')
+          { cpath = getcwd(NULL,0);
+            if (SORT_PATH[0] == '.')
+              { if (SORT_PATH[1] == '/')
+                  spath = Catenate(cpath,SORT_PATH+1,"","");
+                else if (SORT_PATH[1] == '\0')
+                  spath = cpath;
+                else
+                  { fprintf(stderr,"\n%s: -P option: . not followed by /\n",Prog_Name);
+                    exit (1);
+                  }
               }
+            else
+              spath = Catenate(cpath,"/",SORT_PATH,"");
+            SORT_PATH = Strdup(spath,"Allocating path");
+            free(cpath);
           }
         else
-          spath = Catenate(cpath,"/",SORT_PATH,"");
-        SORT_PATH = Strdup(spath,"Allocating path");
-        free(cpath);
+          SORT_PATH = Strdup(SORT_PATH,"Allocating path");
+
+        if ((dirp = opendir(SORT_PATH)) == NULL)
+          { fprintf(stderr,"\n%s: -P option: cannot open directory %s\n",Prog_Name,SORT_PATH);
+            exit (1);
+          }
+        closedir(dirp);
+
+        SORT_PATHS[d] = SORT_PATH;
+        if ((int) strlen(SORT_PATH) > SORT_PLEN)
+          SORT_PLEN = strlen(SORT_PATH);
       }
-    else
-      SORT_PATH = Strdup(SORT_PATH,"Allocating path");
+    SORT_PATH = SORT_PATHS[0];
+  }
 
-    if ((dirp = opendir(SORT_PATH)) == NULL)
-      { fprintf(stderr,"\n%s: -P option: cannot open directory %s\n",Prog_Name,SORT_PATH);
-        exit (1);
+  //  Build the cyclic map of (part,thread) files to directories.  Each directory gets a share
+  //    of the map proportional to its free space (at least 1 slot), and the slots of a
+  //    directory are spread evenly over the cycle (smooth weighted round robin).
+
+  { struct statvfs fs;
+    int64 *avail, total;
+    int   *share, *credit;
+    int    d, i, best;
+
+    avail  = (int64 *) Malloc(sizeof(int64)*NSORTS,"Allocating directory map");
+    share  = (int *) Malloc(sizeof(int)*2*NSORTS,"Allocating directory map");
+    credit = share + NSORTS;
+    if (avail == NULL || share == NULL)
+      exit (1);
+
+    total = 0;
+    for (d = 0; d < NSORTS; d++)
+      { if (statvfs(SORT_PATHS[d],&fs) == 0)
+          avail[d] = ((int64) fs.f_bavail) * fs.f_frsize;
+        else
+          avail[d] = 0;
+        total += avail[d];
+      }
+
+    SORT_MAPLEN = 0;
+    for (d = 0; d < NSORTS; d++)
+      { if (total == 0)
+          share[d] = 1;
+        else
+          share[d] = (int) ((16.*NSORTS*avail[d])/total + .5);
+        if (share[d] < 1)
+          share[d] = 1;
+        SORT_MAPLEN += share[d];
+        credit[d] = 0;
       }
-    closedir(dirp);
+
+    SORT_MAP = (int *) Malloc(sizeof(int)*SORT_MAPLEN,"Allocating directory map");
+    if (SORT_MAP == NULL)
+      exit (1);
+
+    for (i = 0; i < SORT_MAPLEN; i++)
+      { best = 0;
+        for (d = 0; d < NSORTS; d++)
+          { credit[d] += share[d];
+            if (credit[d] > credit[best])
+              best = d;
+          }
+        credit[best] -= SORT_MAPLEN;
+        SORT_MAP[i] = best;
+      }
+
+    if (VERBOSE && NSORTS > 1)
+      { fprintf(stderr,"\n  Striping part files over %d directories:\n",NSORTS);
+        for (d = 0; d < NSORTS; d++)
+          fprintf(stderr,"    %5.1f%%  %s (%.1fGB free)\n",(100.*share[d])/SORT_MAPLEN,
+                         SORT_PATHS[d],avail[d]/1.e9);
+      }
+
+    free(share);
+    free(avail);
   }
 
+  setup_placement();
+
   { Input_Partition *io;
     DATA_BLOCK      *block;
-    int64            gsize;
+    int64            gsize, nkmers;
     int              rsize, val;
+    int              reuse;
 
     ROOT = PATH = NULL;
     IOPACK = NULL;
+    nkmers = 0;
 
     io = Partition_Input(argc,argv);
 
@@ -405,51 +997,128 @@ int main(int argc, char *argv[])
       { ROOT = Root(OUT_NAME,"");
         PATH = PathTo(OUT_NAME);
       }
-
-    if (VERBOSE)
-      fprintf(stderr,"\nDetermining minimizer scheme & partition for %s\n",ROOT);
-
-    //  Determine number of buckets and padded minimzer scheme based on first
-    //    block of the data set
-
-    block = Get_First_Block(io,1000000000);
+    if (SHARD > 0)
+      { char *sroot = Malloc(strlen(ROOT)+20,"Allocating shard name");
+        if (sroot == NULL)
+          Clean_Exit(1);
+        sprintf(sroot,"%s.%d",ROOT,SHARD);
+        free(ROOT);
+        ROOT = sroot;
+      }
 
     KMER_BYTES = (KMER*2+7) >> 3;
 
-    rsize  = KMER_BYTES + 2;
-    gsize  = block->totlen - KMER*block->nreads;
-    if (gsize < block->totlen/3)
-      { fprintf(stderr,
-                "\n%s: Warming Sequences are on average smaller than 1.5x k-mer size!\n",
-                Prog_Name);
-      }
-    gsize = gsize*block->ratio*rsize;
-    NPARTS = (gsize-1)/SORT_MEMORY + 1;
-
-    if (VERBOSE)
-      { double est = gsize/(1.*rsize);
-        if (est >= 5.e8)
-          fprintf(stderr,"  Estimate %.3fG",est/1.e9);
-        else if (est >= 5.e5)
-          fprintf(stderr,"  Estimate %.3fM",est/1.e6);
-        else
-          fprintf(stderr,"  Estimate %.3fK",est/1.e3);
-        fprintf(stderr," %d-%smers\n",KMER,COMPRESS?"hoco-":"");
-        if (NPARTS > 1)
-          fprintf(stderr,"  Dividing data into %d blocks\n",NPARTS);
-        else
-          fprintf(stderr,"  Handling data in a single block\n");
-      }
-
     MOD_LEN = 1;
     while (MOD_LEN < KMER)
       MOD_LEN <<= 1;
     MOD_LEN <<= 1;
     MOD_MSK = MOD_LEN-1;
 
-    MAX_SUPER = Determine_Scheme(block);
+    //  If checkpointing and there is a checkpoint, then all the sizes and the number of parts
+    //    are restored from it, and the scheme, only needed for phase 1, is not determined
+
+    phase = 0;
+    if (RESUME)
+      { CHECKPOINT = Malloc(sizeof(Checkpoint),"Allocating checkpoint");
+        CKPT_NAME  = Malloc(strlen(SORT_PATH)+strlen(ROOT)+10,"Allocating checkpoint");
+        if (CHECKPOINT == NULL || CKPT_NAME == NULL)
+          Clean_Exit(1);
+        sprintf(CKPT_NAME,"%s/%s.ckpt",SORT_PATH,ROOT);
+        CHECKPOINT->phase = 0;
+        CHECKPOINT->parts = 0;
+        CHECKPOINT->split = NULL;
+        INPUT_SIG = input_signature(argc,argv);
+
+        phase = load_checkpoint();
+        if (VERBOSE && phase > 0)
+          { fprintf(stderr,"\nResuming %s from checkpoint after phase %d",ROOT,phase);
+            if (phase == 1 && CHECKPOINT->parts > 0)
+              fprintf(stderr," and %d of %d blocks of phase 2",CHECKPOINT->parts,NPARTS);
+            fprintf(stderr,"\n");
+          }
+      }
 
-    Free_First_Block(block);
+    if (phase == 0)
+      {
+        //  If a scheme file is given and exists then reuse its scheme, in which case only a small
+        //    first block is needed to estimate the size of the data set
+
+        reuse = 0;
+        if (SCHEME != NULL)
+          { int len = strlen(SCHEME);
+
+            if (len < 7 || strcmp(SCHEME+(len-7),".scheme") != 0)
+              SCHEME = Strdup(Catenate(SCHEME,"",".scheme",""),"Allocating scheme name");
+            reuse = (access(SCHEME,F_OK) == 0);
+          }
+
+        if (VERBOSE)
+          { if (reuse)
+              fprintf(stderr,"\nLoading minimizer scheme & partition for %s\n",ROOT);
+            else
+              fprintf(stderr,"\nDetermining minimizer scheme & partition for %s\n",ROOT);
+          }
+
+        //  Determine number of buckets and padded minimzer scheme based on first
+        //    block of the data set
+
+        if (reuse)
+          block = Get_First_Block(io,10000000);
+        else
+          block = Get_First_Block(io,1000000000);
+
+        rsize  = KMER_BYTES + 2;
+        gsize  = block->totlen - KMER*block->nreads;
+        if (gsize < block->totlen/3)
+          { fprintf(stderr,
+                    "\n%s: Warming Sequences are on average smaller than 1.5x k-mer size!\n",
+                    Prog_Name);
+          }
+        gsize = gsize*block->ratio*rsize;
+        nkmers = gsize/rsize;
+        NPARTS = (gsize-1)/SORT_MEMORY + 1;
+        if (NPARTS < NSHARDS)
+          NPARTS = NSHARDS;
+
+        if (VERBOSE)
+          { double est = gsize/(1.*rsize);
+            if (est >= 5.e8)
+              fprintf(stderr,"  Estimate %.3fG",est/1.e9);
+            else if (est >= 5.e5)
+              fprintf(stderr,"  Estimate %.3fM",est/1.e6);
+            else
+              fprintf(stderr,"  Estimate %.3fK",est/1.e3);
+            fprintf(stderr," %d-%smers\n",KMER,COMPRESS?"hoco-":"");
+            if (NPARTS > 1)
+              fprintf(stderr,"  Dividing data into %d blocks\n",NPARTS);
+            else
+              fprintf(stderr,"  Handling data in a single block\n");
+          }
+
+        if (reuse)
+          MAX_SUPER = Load_Scheme(SCHEME);
+        else
+          { MAX_SUPER = Determine_Scheme(block);
+            if (SCHEME != NULL)
+              Save_Scheme(SCHEME);
+          }
+        if (SHARD > 0)
+          Shard_Scheme(SHARD,NSHARDS);
+
+        Free_First_Block(block);
+
+        if (CHECKPOINT != NULL)
+          alloc_checkpoint();
+      }
+
+    //  If only one part, then phase 2 can take the super-mers directly from memory, unless
+    //    checkpointing in which case they must be on disk
+
+#ifdef DEVELOPER
+    IN_CORE = 0;
+#else
+    IN_CORE = (NPARTS == 1 && CHECKPOINT == NULL);
+#endif
 
     SMER = MAX_SUPER + KMER - 1;
   
@@ -465,18 +1134,24 @@ int main(int argc, char *argv[])
     PLEN_BYTES = (SLEN_BITS+8) >> 3;
     TMER_WORD  = KMER_BYTES + 2;
 
-    //  Make sure you can open (NPARTS + 2) * NTHREADS + tid files and then set up data structures
-    //    for each such file.  tid is typically 3 unless using valgrind or other instrumentation.
+    //  Make sure you can open (NPARTS + 2) * T + tid files and then set up data structures
+    //    for each such file, where T is the largest of the sort, input, and table part thread
+    //    counts.  tid is typically 3 unless using valgrind or other instrumentation.
 
     { struct rlimit rlp;
-      int           tid;
+      int           tid, nthr;
       uint64        nfiles;
 
       tid = open(".xxx",O_CREAT|O_TRUNC|O_WRONLY,S_IRWXU);
       close(tid);
       unlink(".xxx");
 
-      nfiles = (NPARTS+3)*NTHREADS + tid;
+      nthr = NTHREADS;
+      if (ITHREADS > nthr)
+        nthr = ITHREADS;
+      if (NTABLES > nthr)
+        nthr = NTABLES;
+      nfiles = (NPARTS+3)*nthr + tid;
       getrlimit(RLIMIT_NOFILE,&rlp);
       if (nfiles > rlp.rlim_max)
         { fprintf(stderr,"\n%s: Cannot open %lld files simultaneously\n",Prog_Name,nfiles);
@@ -486,6 +1161,9 @@ int main(int argc, char *argv[])
       setrlimit(RLIMIT_NOFILE,&rlp);
     }
 
+    PASS_BEG = 0;
+    PASS_END = NPARTS;
+
 #ifdef DEVELOPER
     if (DO_STAGE == 1)
       { Split_Kmers(io,ROOT);
@@ -493,11 +1171,31 @@ int main(int argc, char *argv[])
           Split_Table(ROOT);
       }
 #else
-    Split_Kmers(io,ROOT);
-    if (VERBOSE)
-      timeTo(stderr,0);
-    if (PRO_TABLE != NULL)
-      { Split_Table(ROOT);
+    PASS_END = Next_Pass(0,nkmers);
+    if (phase < 1)
+      { Split_Kmers(io,ROOT);
+        if (VERBOSE)
+          timeTo(stderr,0);
+        if (PRO_TABLE != NULL)
+          { Split_Table(ROOT);
+            if (VERBOSE)
+              timeTo(stderr,0);
+          }
+        if (CHECKPOINT != NULL)
+          Save_Checkpoint(1);
+      }
+
+    //  If the super-mer files of all the parts would exceed the disk budget, then sort the
+    //    parts of this pass (removing their files) and make another pass over the input for
+    //    the next group of parts.  The last group is sorted by phase 2 proper below.
+
+    while (PASS_END < NPARTS)
+      { Sorting(PATH,ROOT);
+        if (VERBOSE)
+          timeTo(stderr,0);
+        PASS_BEG = PASS_END;
+        PASS_END = Next_Pass(PASS_BEG,nkmers);
+        Split_Kmers(io,ROOT);
         if (VERBOSE)
           timeTo(stderr,0);
       }
@@ -510,9 +1208,13 @@ int main(int argc, char *argv[])
   if (DO_STAGE == 2)
     Sorting(PATH,ROOT);
 #else
-  Sorting(PATH,ROOT);
-  if (VERBOSE)
-    timeTo(stderr,0);
+  if (phase < 2)
+    { Sorting(PATH,ROOT);
+      if (VERBOSE)
+        timeTo(stderr,0);
+      if (CHECKPOINT != NULL)
+        Save_Checkpoint(2);
+    }
 #endif
 
   if (DO_TABLE > 0)
@@ -520,10 +1222,13 @@ int main(int argc, char *argv[])
     if (DO_STAGE == 3)
       Merge_Tables(PATH,ROOT);
 #else
-    { Merge_Tables(PATH,ROOT);
-      if (VERBOSE)
-        timeTo(stderr,0);
-    }
+    if (phase < 3)
+      { Merge_Tables(PATH,ROOT);
+        if (VERBOSE)
+          timeTo(stderr,0);
+        if (CHECKPOINT != NULL)
+          Save_Checkpoint(3);
+      }
 #endif
 
   if (DO_PROFILE > 0)
@@ -537,13 +1242,22 @@ int main(int argc, char *argv[])
     }
 #endif
 
+  if (CHECKPOINT != NULL)
+    remove_checkpoint();
+
 #ifndef DEVELOPER
   free(NUM_RID);
 #endif
 
   free(PATH);
   free(ROOT);
-  free(SORT_PATH);
+  { int d;
+
+    for (d = 0; d < NSORTS; d++)
+      free(SORT_PATHS[d]);
+    free(SORT_PATHS);
+    free(SORT_MAP);
+  }
 
   if (PRO_TABLE != NULL)
     Free_Kmer_Stream(PRO_TABLE);
@@ -36,7 +36,22 @@ extern int64  SORT_MEMORY; // Memory available for each k-mer sort
 extern int    KMER;        //  desired K-mer length
 extern int    NTHREADS;    //  # of threads to run with
 extern int      ITHREADS;    //  # of threads possible for input
-extern char  *SORT_PATH;   //  where to put external files
+extern int    IO_THREADS;  //  # of threads to read the input with (-Ti, ITHREADS <= IO_THREADS)
+extern int    NTABLES;     //  # of parts of the k-mer table (-To)
+extern char  *SORT_PATH;   //  where to put external files (= SORT_PATHS[0])
+extern int    NSORTS;      //  # of directories to stripe the part files over
+extern char **SORT_PATHS;  //  [i] for i in [0,NSORTS) = i'th such directory
+extern int    SORT_PLEN;   //  length of the longest of these paths
+
+  char *Sort_Path(int part, int thread);   //  Directory for the files of part & thread
+
+  int64 Read_All(int fd, void *buf, int64 len);    //  read/write all len bytes of buf
+  int64 Write_All(int fd, void *buf, int64 len);   //    (unless EOF or error)
+
+extern int    NUMA_NODES;  //  # of memory nodes the sort threads are spread over
+
+  void Pin_Thread(int t);   //  Keep the calling thread on the node of sort thread t
+  void Unpin_Thread();      //  Let the calling thread run on any CPU of the process again
 
 extern int    DO_TABLE;    // Zero or table cutoff
 extern int    DO_PROFILE;  // Do or not
@@ -44,11 +59,15 @@ extern Kmer_Stream *PRO_TABLE;   //  Kmer stream of profile option (only if rela
 extern char        *PRO_NAME;    //  Name of profile table
 extern int    BC_PREFIX;   // Ignore prefix of each read of this length
 extern int    COMPRESS;    // Homopolymer compress the input
+extern int    ZIP_SMERS;   // Compress the super-mer files placed in SORT_PATH
+extern int64  DISK_BUDGET; // Max bytes of super-mer files at any one time (0 => no limit)
 
 
   //  Sizes and numbers of items (k-mers, super-mers, reads, positions)
 
 extern int    NPARTS;      //  number of k-mer buckets
+extern int    PASS_BEG;    //  The current pass over the input distributes and sorts the
+extern int    PASS_END;    //    buckets in [PASS_BEG,PASS_END) (all of them unless -D)
 extern int    SMER;        //  max size of a super-mer (= MAX_SUPER + KMER - 1)ZZ
 extern int64  KMAX;        //  max k-mers in any part
 extern int64  NMAX;        //  max super-mers in any part
@@ -80,6 +99,39 @@ extern int CMER_WORD;    //  bytes to hold a count/position entry
 
 extern int64 *NUM_RID;   //  [i] for i in [0,ITHREADS) = # of super-mers per vertical stripe
 
+  //  If there is but a single part (NPARTS = 1) then the bit packed super-mers of each thread
+  //    are kept in memory rather than being written to and then read back from SORT_PATH
+
+typedef struct
+  { int64     kmers;       //  # of k-mers
+    int64     nmers;       //  # of super-mers
+    int64     fours[256];  //  fours[i] = # of canonical super-mers with first byte i
+    int64     dlen;        //  # of words of data (allocated length is dlen + IO_BUF_LEN)
+    IO_UTYPE *data;        //  bit packed super-mer list
+  } Core_List;
+
+extern int        IN_CORE;     //  Super-mer lists are held in memory
+extern Core_List *CORE_LIST;   //  [i] for i in [0,ITHREADS) = super-mer list of thread i
+
+  //  If checkpointing (-R) then the state needed to resume the run after the last completed
+  //    phase, or part of phase 2, is saved in SORT_PATH/<root>.ckpt, and the files in SORT_PATH
+  //    are only removed once the unit that consumes them has been checkpointed.
+
+typedef struct
+  { int    phase;           //  # of phases completed
+    int    parts;           //  # of parts of phase 2 completed
+    int64  counts[0x8000];  //  k-mer count histogram of these parts
+    int64  max_inst;        //  # of k-mer instances with count >= 0x7fff in these parts
+    int64  tmers;           //  # of table entries output for these parts
+    int   *split;           //  [i] for i in [0,NTHREADS) = first byte of table thread i
+    int64 *wkmers;          //  [i] for i in [0,NPARTS) = # of weighted k-mers of part i
+    int64 *ukmers;          //  [i] for i in [0,NPARTS) = # of k-mers of part i
+  } Checkpoint;
+
+extern Checkpoint *CHECKPOINT;   //  Non-NULL iff checkpointing
+
+void Save_Checkpoint(int phase);
+
 extern uint8 Comp[256];  //  complement of 4bp byte code
 
   //  IO Module Interface
@@ -118,7 +170,12 @@ void Clean_Exit(int status);
 
 int Determine_Scheme(DATA_BLOCK *block);
 
+void Save_Scheme(char *name);
+int  Load_Scheme(char *name);
+void Shard_Scheme(int shard, int nshards);
+
 void Split_Kmers(Input_Partition *io, char *root);
+int  Next_Pass(int beg, int64 kmers);
 
   void Distribute_Block(DATA_BLOCK *block, int tid);
 
@@ -126,6 +183,10 @@ void Split_Table(char *root);
 
 void Sorting(char *path, char *root);
 
+  void Start_Pool();    //  Persistent workers for the threaded steps of Sorting: Run_Pool has
+  void Stop_Pool();     //    worker t mod NTHREADS call task(args+t*size) for t in [0,n)
+  void Run_Pool(void *(*task)(void *), void *args, int size, int n);
+
 void Merge_Tables(char *path, char *root);
 
 void Merge_Profiles(char *path, char *root);
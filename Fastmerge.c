@@ -19,11 +19,14 @@
 #undef    DEBUG_PROF
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 
-static char *Usage = " [-htp] [-T<int(4)>] <target> <sources>[.hist|.ktab|.prof] ...";
+static char *Usage = " [-htps] [-T<int(4)>] <target> <sources>[.hist|.ktab|.prof] ...";
 
 static int NTHREADS;
 
+#define READ_AHEAD 0x10000000   //  Bytes of stream buffers over all tables and threads
+
 
 /****************************************************************************************
  *
@@ -43,14 +46,6 @@ typedef struct
     int           dotab;
   } TP;
 
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n-- > 0)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
 static void *table_thread(void *args)
 { TP *parm = (TP *) args;
   int           tid   = parm->tid;
@@ -373,6 +368,7 @@ int main(int argc, char *argv[])
   int           DO_HIST;
   int           DO_TABLE;
   int           DO_PROF;
+  int           SHARDS;
 
   { int    i, j, k;
     int    flags[128];
@@ -389,7 +385,7 @@ int main(int argc, char *argv[])
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("htp")
+            ARG_FLAGS("htps")
             break;
           case 'T':
             ARG_POSITIVE(NTHREADS,"Number of threads")
@@ -402,6 +398,7 @@ int main(int argc, char *argv[])
     DO_HIST  = flags['h'];
     DO_TABLE = flags['t'];
     DO_PROF  = flags['p'];
+    SHARDS   = flags['s'];
 
     if (argc < 4)
       { fprintf(stderr,"\nUsage: %s %s\n",Prog_Name,Usage);
@@ -410,6 +407,7 @@ int main(int argc, char *argv[])
         fprintf(stderr,"      -t: Produce a merged k-mer table.\n");
         fprintf(stderr,"      -p: Produce a merged profile.\n");
         fprintf(stderr,"\n");
+        fprintf(stderr,"      -s: Sources are the shards of a single FastK run (FastK -s).\n");
         fprintf(stderr,"      -T: Use -T threads.\n");
         exit (1);
       } 
@@ -491,13 +489,52 @@ int main(int argc, char *argv[])
             }
         }
 
-      if (DO_HIST && has_table == 0)
+      if (DO_HIST && has_table == 0 && !SHARDS)
         { fprintf(stderr,"%s: Need source tables to compute merged histograms\n",Prog_Name);
           exit (1);
         }
+      if (DO_PROF && SHARDS)
+        { fprintf(stderr,"%s: Shards do not have profiles to merge\n",Prog_Name);
+          exit (1);
+        }
     }
   }   
 
+  //  Shards of a single FastK run count disjoint sets of k-mers, so their histograms,
+  //    including those of k-mers not in the tables, simply add
+
+  if (DO_HIST && SHARDS)
+    { Histogram *H, *G;
+      int        c, j;
+
+      H = Load_Histogram(argv[0]);
+      if (H == NULL)
+        { fprintf(stderr,"%s: Cannot open histogram %s\n",Prog_Name,argv[0]);
+          exit (1);
+        }
+      for (c = 1; c < narg; c++)
+        { G = Load_Histogram(argv[c]);
+          if (G == NULL)
+            { fprintf(stderr,"%s: Cannot open histogram %s\n",Prog_Name,argv[c]);
+              exit (1);
+            }
+          if (G->kmer != H->kmer || G->low != H->low || G->high != H->high)
+            { fprintf(stderr,"%s: Histograms do not involve the same K and range\n",Prog_Name);
+              exit (1);
+            }
+          for (j = H->low; j <= H->high+2; j++)
+            H->hist[j] += G->hist[j];
+          Free_Histogram(G);
+        }
+
+      if (Write_Histogram(Catenate(Opath,"/",Oroot,".hist"),H))
+        { fprintf(stderr,"%s: Cannot create histogram for output %s\n",Prog_Name,Oroot);
+          exit (1);
+        }
+      Free_Histogram(H);
+      DO_HIST = 0;
+    }
+
   if (DO_HIST || DO_TABLE)
     {
       { int c;
@@ -523,6 +560,8 @@ int main(int argc, char *argv[])
               }
             S[c] = s;
           }
+        for (c = 0; c < narg; c++)
+          Readahead_Kmer_Stream(S[c],READ_AHEAD/(2*narg*NTHREADS));
       }
     
       { int64     range[NTHREADS+1][narg];
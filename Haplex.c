@@ -18,9 +18,12 @@
 #undef DEBUG_PARTITION
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 
 static char *Usage = " -H [-g<int>:<int>] <source>[.ktab]";
 
+#define READ_AHEAD 0x400000   //  Bytes of each stream buffer when reading sequentially
+
 /****************************************************************************************
  *
  *  Print & compare utilities
@@ -95,14 +98,6 @@ static void print_hap(uint8 *seq, int len, int half)
     }
 }
 
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n-- > 0)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
 
 /****************************************************************************************
  *
@@ -530,6 +525,7 @@ int main(int argc, char *argv[])
     { fprintf(stderr,"%s: Cannot open table %s\n",Prog_Name,argv[1]);
       exit (1);
     }
+  Readahead_Kmer_Stream(T,READ_AHEAD);
 
   if (FOR_HAYNES)
     Find_Haplo_Pairs2(T);
@@ -19,9 +19,12 @@
 #undef    DEBUG_DATA_POINT
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 
 static char *Usage = "-e<int> -g<int>:<int> <source_root>[.ktab]";
 
+#define READ_AHEAD 0x400000   //  Bytes of each stream buffer when reading sequentially
+
 #define MAX_HOMO_LEN 10
 
 /****************************************************************************************
@@ -73,11 +76,6 @@ static void print_seq(uint8 *seq, int len)
 
 #endif
 
-static inline void mycpy(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    *a++ = *b++;
-}
-
 
 /****************************************************************************************
  *
@@ -459,6 +457,7 @@ int main(int argc, char *argv[])
   }
 
   T = Open_Kmer_Stream(argv[1]);
+  Readahead_Kmer_Stream(T,READ_AHEAD);
 
   P = Count_Homopolymer_Errors(T);
 
@@ -29,6 +29,16 @@ typedef long long     int64;
 
 static int    RSIZE;    //  Span between records
 
+//  Write combining: when records are small, each thread stages the records for a bucket
+//    in a WC_BYTES buffer and copies them to the target WC_RECS at a time, so that the
+//    scatter touches 256 small buffers and makes one long write per buffer instead of
+//    one short write to a far away page per record.
+
+#define WC_BYTES  256       //  Staging bytes per bucket per thread
+#define WC_MIN    0x10000   //  Only stage if the sort has at least this many elements
+
+static int    WC_RECS;  //  # of records per buffer (0 => copy records directly)
+
 //  Global variables for every "lex_thread"
 
 static int      LEX_byte;   //  Current byte to sort on
@@ -47,8 +57,40 @@ typedef struct
     int64  thresh[256];   //  If check then multiple of LEX_zdiv to check for thread assignment
     int64  tptr[256];     //  Finger for each 8-bit value
     int64 *sptr;          //  Conceptually [256][NTHREADS].  At end of sorting pass
-  } Lex_Arg;              //    sprtr[b][n] = # of occurences of value b in rangd of
+                          //    sprtr[b][n] = # of occurences of value b in rangd of
                           //    thread n for the *next* pass
+    uint8 *stage;         //  [256][WC_BYTES] staging buffers (if WC_RECS > 0)
+    int    fill[256];     //  # of records in each buffer
+    int64  base[256];     //  Target offset of the 1st record in each buffer
+  } Lex_Arg;
+
+static Lex_Arg *LEX_parm;   //  Thread t is controlled by LEX_parm[t]
+
+//  Stage record rec bound for offset x of the target in buffer d, emptying it when full
+
+static inline void wc_put(Lex_Arg *data, uint8 *rec, int d, int64 x)
+{ int    k   = data->fill[d];
+  uint8 *buf = data->stage + d*WC_BYTES;
+
+  if (k == 0)
+    data->base[d] = x;
+  memcpy(buf+k*RSIZE,rec,RSIZE);
+  if (++k == WC_RECS)
+    { memcpy(LEX_trg+data->base[d],buf,WC_RECS*RSIZE);
+      k = 0;
+    }
+  data->fill[d] = k;
+}
+
+static void wc_flush(Lex_Arg *data)
+{ int d;
+
+  for (d = 0; d < 256; d++)
+    if (data->fill[d] > 0)
+      { memcpy(LEX_trg+data->base[d],data->stage+d*WC_BYTES,data->fill[d]*RSIZE);
+        data->fill[d] = 0;
+      }
+}
 
 //  Threaded sorting pass
 
@@ -68,8 +110,34 @@ static void *lex_thread(void *arg)
   int64       i, n, x;
   uint8       d;
 
+  Pin_Thread(data-LEX_parm);
+
   n = data->end;
-  if (LEX_next < 0)
+  if (WC_RECS > 0)
+    { if (LEX_next < 0)
+        for (i = data->beg; i < n; i += RSIZE)
+          { d = dig[i];
+            x = tptr[d];
+            tptr[d] += RSIZE;
+            wc_put(data,src+i,d,x);
+          }
+      else
+        for (i = data->beg; i < n; i += RSIZE)
+          { d = dig[i];
+            x = tptr[d];
+            tptr[d] += RSIZE;
+            wc_put(data,src+i,d,x);
+            if (check[d])
+              { if (x >= thresh[d])
+                  { next[d]   += 0x100;
+                    thresh[d] += zdiv;
+                  }
+              }
+            sptr[next[d] | nig[i]] += 1;
+          }
+      wc_flush(data);
+    }
+  else if (LEX_next < 0)
     for (i = data->beg; i < n; i += RSIZE)
       { d = dig[i];
         x = tptr[d];
@@ -102,6 +170,8 @@ static void *lexbeg_thread(void *arg)
 
   int64       i, n;
 
+  Pin_Thread(data-LEX_parm);
+
   n = data->end;
   for (i = data->beg; i < n; i += RSIZE)
     tptr[dig[i]] += 1;
@@ -127,14 +197,33 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int *bytes)
   LEX_src  = (uint8 *) src;
   LEX_trg  = (uint8 *) trg;
 
+  //  Stage records only if at least 4 fit in a buffer and there are enough of them
+
+  if (RSIZE <= WC_BYTES/4 && nelem >= WC_MIN)
+    WC_RECS = WC_BYTES/RSIZE;
+  else
+    WC_RECS = 0;
+
   parmx   = Malloc(sizeof(Lex_Arg)*NTHREADS,"LSD sort vectors");
   threads = Malloc(sizeof(pthread_t)*NTHREADS,"LSD sort vectors");
   parmx[0].sptr = Malloc(sizeof(int64)*256*NTHREADS*NTHREADS,"LSD sort vectors");
-  if (parmx == NULL || threads == NULL || parmx[0].sptr == NULL)
+  if (WC_RECS > 0)
+    parmx[0].stage = Malloc(WC_BYTES*256*NTHREADS,"LSD sort vectors");
+  else
+    parmx[0].stage = NULL;
+  if (parmx == NULL || threads == NULL || parmx[0].sptr == NULL
+                    || (WC_RECS > 0 && parmx[0].stage == NULL))
     exit (1);
+  LEX_parm = parmx;
 
   for (i = 1; i < NTHREADS; i++)
-    parmx[i].sptr = parmx[i-1].sptr + NTHREADS*256;
+    { parmx[i].sptr  = parmx[i-1].sptr + NTHREADS*256;
+      if (WC_RECS > 0)
+        parmx[i].stage = parmx[i-1].stage + WC_BYTES*256;
+    }
+  for (i = 0; i < NTHREADS; i++)
+    for (j = 0; j < 256; j++)
+      parmx[i].fill[j] = 0;
 
   //  For each requested byte b in order, radix sort
 
@@ -263,6 +352,9 @@ void *LSD_Sort(int64 nelem, void *src, void *trg, int rsize, int *bytes)
 #endif
     }
 
+  Unpin_Thread();
+
+  free(parmx[0].stage);
   free(parmx[0].sptr);
   free(threads);
   free(parmx);
@@ -17,12 +17,15 @@
 #undef  DEBUG_TRACE
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 
 static char *Usage[] = { " [-T<int(4)>] [-[hH][<int(1)>:]<int>]",
                          "   <output:name=expr> ... <source_root>[.ktab] ..." };
 
 #define MAX_TABS 8
 
+#define READ_AHEAD 0x10000000   //  Bytes of stream buffers over all tables and threads
+
 static int DO_TABLE;
 static int NTHREADS;
 static int HIST_LOW, HIST_HGH;
@@ -961,14 +964,6 @@ static inline int gcontent(uint8 *a, int kbyte)
   return (cnt+GCR[*a]);
 }
 
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n-- > 0)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
 static void *merge_thread(void *args)
 { TP *parm = (TP *) args;
   int           tid   = parm->tid;
@@ -1360,6 +1355,8 @@ int main(int argc, char *argv[])
           }
         S[c-1] = s;
       }
+    for (c = 0; c < narg; c++)
+      Readahead_Kmer_Stream(S[c],READ_AHEAD/(2*narg*NTHREADS));
 
     gc_setup(kmer);
   }
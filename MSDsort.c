@@ -10,6 +10,7 @@
 #include <pthread.h>
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 #include "FastK.h"
 
 #undef  IS_SORTED
@@ -33,6 +34,14 @@ static char *fmer[256], _fmer[1280];
 #define GAP1  9
 #define GAP2  4
 
+#define NET_MIN   4     //  Buckets of [NET_MIN,NET_MAX] elements are sorted by net_sort
+#define NET_MAX  16     //    (NET_MAX <= 256)
+
+#define HASH_SLOTS  0x10000   //  Slots in the open-addressing hash table of a thread
+#define HASH_MAX     0x8000   //  Give up hashing a bucket when it has more distinct k-mers
+#define HASH_SKEW         4   //  Only try buckets this many times the size expected at their depth
+#define HASH_FLOOR     1024   //    and with at least this many entries
+
 static int S_thr0, S_thr1, S_thr2;
 static int S_gap1, S_gap2;
 
@@ -40,21 +49,9 @@ static int    RSIZE;
 static int    KSIZE;
 static int64 *PARTS;
 static uint8 *ARRAY;
+static Range *PANEL;    //  Panels of the threads (their byte ranges, histograms, & counts)
 static void  (*COUNT)(uint8 *,int64,Range *);
 
-static inline void mycpy(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    *a++ = *b++;
-}
-
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
 #ifdef IS_SORTED
 
 static inline void sorted(uint8 *array, int64 asize, int digit)
@@ -126,8 +123,210 @@ static inline void shell_sort(uint8 *array, int asize, int digit, Range *rng)
   COUNT(array+j,asize-j,rng);
 }
 
-static void radix_sort(uint8 *array, int64 asize, int digit, int64 *alive, Range *rng)
-{ int64  n, len[256];
+  //  Buckets of NET_MIN to NET_MAX elements whose remaining key is at most 7 bytes are sorted
+  //    by packing the key and the element's index into a 64-bit word (key in the high
+  //    bytes) and sorting these words with a Batcher odd-even merge network, whose
+  //    compare-exchanges are branch-free min/max's.  The comparators of the network for
+  //    each size are computed once by net_setup.  The elements are then moved into place.
+
+static uint8  NET_PAIR[NET_MAX+1][2*NET_MAX*NET_MAX];  //  Comparators for n elements
+static int    NET_SIZE[NET_MAX+1];                     //    and the # of them
+
+static void net_setup()
+{ static int done = 0;
+  int n, i, j, k, p, c;
+
+  if (done)
+    return;
+  for (n = 2; n <= NET_MAX; n++)
+    { c = 0;
+      for (p = 1; p < n; p <<= 1)
+        for (k = p; k >= 1; k >>= 1)
+          for (j = k % p; j + k < n; j += 2*k)
+            for (i = 0; i < k && i+j+k < n; i++)
+              if ((i+j)/(2*p) == (i+j+k)/(2*p))
+                { NET_PAIR[n][c++] = i+j;
+                  NET_PAIR[n][c++] = i+j+k;
+                }
+      NET_SIZE[n] = c;
+    }
+  done = 1;
+}
+
+static inline void net_sort(uint8 *array, int asize, int digit, Range *rng)
+{ uint64  e[NET_MAX];
+  uint8   temp[asize];
+  uint8  *garray, *pair;
+  uint64  x, y;
+  int     cmp, n, c;
+  int     i, j, p;
+
+  cmp    = KSIZE-digit;
+  garray = array+digit;
+  n      = asize/RSIZE;
+
+  for (i = 0, p = 0; i < n; i++, p += RSIZE)
+    { x = 0;
+      for (j = 0; j < cmp; j++)
+        x = (x << 8) | garray[p+j];
+      e[i] = (x << 8*(8-cmp)) | i;
+    }
+
+  pair = NET_PAIR[n];
+  c    = NET_SIZE[n];
+  for (j = 0; j < c; j += 2)
+    { x = e[pair[j]];
+      y = e[pair[j+1]];
+      e[pair[j]]   = (x < y ? x : y);
+      e[pair[j+1]] = (x < y ? y : x);
+    }
+
+  for (i = 0, p = 0; i < n; i++, p += RSIZE)
+    mycpy(temp+p,array+(e[i]&0xff)*RSIZE,RSIZE);
+  memcpy(array,temp,asize);
+
+  j = 0;
+  for (i = 1; i < n; i++)
+    if ((e[i] >> 8) != (e[j] >> 8))
+      { COUNT(array+j*RSIZE,(i-j)*RSIZE,rng);
+        j = i;
+      }
+  COUNT(array+j*RSIZE,asize-j*RSIZE,rng);
+}
+
+  //  Sort a bucket too small for radix_sort.  Timed on 10 and 12 byte elements, net_sort
+  //    is about twice as fast as shell_sort for 8 to 32 elements, breaks even at 4, and is
+  //    slower for 2 or 3, where shell_sort is just an insertion sort.
+
+static inline void small_sort(uint8 *array, int asize, int digit, Range *rng)
+{ if (KSIZE-digit <= 7 && asize >= NET_MIN*RSIZE && asize <= NET_MAX*RSIZE)
+    net_sort(array,asize,digit,rng);
+  else
+    shell_sort(array,asize,digit,rng);
+}
+
+  //  The byte buckets are sorted by work-stealing.  Thread t first sorts the buckets of its
+  //    own panel front to back, and then takes buckets one at a time from the back of the
+  //    panel with the most left, so one large bucket (e.g. a high-copy repeat) does not leave
+  //    the other threads idle.  A thread keeps its counts and the histogram of the bucket it
+  //    is sorting in a scratch Range, and adds the latter to the panel of the bucket.
+
+typedef struct
+  { int             next;    //  Buckets [next,last) of the panel remain to be sorted
+    int             last;
+    pthread_mutex_t lock;
+    Range          *rng;     //  Scratch counts of the thread
+    int             hash;    //  Hash counting is on (HASH_COUNT) and not already in progress
+    int            *slot;    //  Hash table of the thread (all -1 when not in use)
+    int            *sidx;    //    slot, offset of 1st entry, & total weight of each distinct k-mer
+    int64          *first;
+    int64          *wgt;
+  } Steal;
+
+  //  The k-mers of a block are spread fairly evenly over their leading bytes, so a bucket
+  //    whose first d bytes agree holds about 1/256^d of the block, and one that is many
+  //    times bigger than that is dominated by a few high-copy k-mers (e.g. organelles or
+  //    repeats).  These show up most often below the top level, e.g. a repeat family is a
+  //    few of the 2- or 3-byte buckets of an otherwise ordinary 1-byte bucket.  For such a
+  //    (sub-)bucket, hash_bucket first adds up the weights of its k-mers in a table small
+  //    enough to stay in cache, and if there are no more than HASH_MAX distinct k-mers and
+  //    on average at least 2 entries per k-mer, moves one entry for each to the front of
+  //    the bucket (the rest, whose first byte remains 0, form a tail of the last run) and
+  //    sorts just these.  Otherwise it gives up, leaving the bucket untouched, and returns 0.
+
+static int   HASH_COUNT;
+static int64 HASH_SIZE;   //  Bytes in the block being sorted
+
+static void radix_sort(uint8 *array, int64 asize, int digit, int64 *alive, Steal *own);
+
+static inline int hash_worthy(int64 asize, int digit, Steal *own)
+{ int64 expect;
+
+  if ( ! own->hash || asize < HASH_FLOOR*RSIZE)
+    return (0);
+  if (8*digit < 63)
+    expect = HASH_SIZE >> (8*digit);
+  else
+    expect = 0;
+  return (asize >= HASH_SKEW*expect);
+}
+
+static int hash_bucket(uint8 *array, int64 asize, int digit, Steal *own, int64 *alive)
+{ int   *slot  = own->slot;
+  int   *sidx  = own->sidx;
+  int64 *first = own->first;
+  int64 *wgt   = own->wgt;
+  Range *rng   = own->rng;
+  int    cmp   = KSIZE-digit;
+  int64  umax;
+
+  uint64 key;
+  uint8 *a;
+  int64  o, c;
+  int    h, i, u, x;
+
+  umax = asize / (2*RSIZE);
+  if (umax > HASH_MAX)
+    umax = HASH_MAX;
+
+  u = 0;
+  for (o = 0; o < asize; o += RSIZE)
+    { a   = array + (o+digit);
+      key = 0xcbf29ce484222325ull;
+      for (i = 0; i < cmp; i++)
+        key = (key ^ a[i]) * 0x100000001b3ull;
+      x = (key ^ (key >> 29)) & (HASH_SLOTS-1);
+      while ((h = slot[x]) >= 0)
+        { if (mycmp(array + (first[h]+digit),a,cmp) == 0)
+            break;
+          x = (x+1) & (HASH_SLOTS-1);
+        }
+      if (h < 0)
+        { if (u >= umax)
+            break;
+          slot[x]  = h = u++;
+          sidx[h]  = x;
+          first[h] = o;
+          wgt[h]   = 0;
+        }
+      wgt[h] += *((uint16 *) (a+cmp));
+    }
+
+  for (h = 0; h < u; h++)
+    slot[sidx[h]] = -1;
+  if (o < asize)
+    return (0);
+
+  //  The 1st entry of the h'th distinct k-mer is at or after entry h so compaction is safe.
+  //    The excess of a count over 0x7fff is added to max_inst here as COUNT sees only 0x7fff.
+
+  for (h = 0; h < u; h++)
+    { a = array + ((int64) h)*RSIZE;
+      if (first[h] != a-array)
+        mycpy(a,array+first[h],KSIZE);
+      c = wgt[h];
+      if (c > 0x7fff)
+        { rng->max_inst += c-0x7fff;
+          c = 0x7fff;
+        }
+      *((uint16 *) (a+KSIZE)) = c;
+    }
+
+  o = ((int64) u)*RSIZE;
+  own->hash = 0;
+  if (o > S_thr0)
+    radix_sort(array,o,digit,alive,own);
+  else if (o > RSIZE)
+    small_sort(array,o,digit,rng);
+  else
+    COUNT(array,o,rng);
+  own->hash = HASH_COUNT;
+  return (1);
+}
+
+static void radix_sort(uint8 *array, int64 asize, int digit, int64 *alive, Steal *own)
+{ Range *rng = own->rng;
+  int64  n, len[256];
   int    y, ntop;
   int    nzero[256];
 
@@ -245,9 +444,11 @@ static void radix_sort(uint8 *array, int64 asize, int digit, int64 *alive, Range
     for (y = 0; y < ntop; y++)
       { n = len[nzero[y]];
         if (n > S_thr0)
-          radix_sort(array, n, digit, alive, rng);
+          { if ( ! (hash_worthy(n,digit,own) && hash_bucket(array,n,digit,own,alive)))
+              radix_sort(array, n, digit, alive, own);
+          }
         else if (n > RSIZE)
-          shell_sort(array, n, digit, rng);
+          small_sort(array, n, digit, rng);
         else if (n > 0)
           COUNT(array,n,rng);
         array += n;
@@ -262,42 +463,93 @@ static void radix_sort(uint8 *array, int64 asize, int digit, int64 *alive, Range
 
 static int INIT_COUNTS;
 
-static void *sort_thread(void *arg) 
-{ Range *param = (Range *) arg;
+static Steal *STEAL;
+static int    NSTEAL;
+static int64  BOFF[256];    //  Bucket x is at ARRAY + BOFF[x]
+static int    OWNER[256];   //    and in panel OWNER[x]
+
+static int take_bucket(int t)
+{ Steal *s;
+  int    x, n, v, most;
 
-  int      beg   = param->beg;
-  int      end   = param->end;
-  int64    off   = param->off;
-  int64   *khist = param->khist;
-  int64   *count = param->count;
+  s = STEAL + t;
+  pthread_mutex_lock(&s->lock);
+  if (s->next < s->last)
+    x = s->next++;
+  else
+    x = -1;
+  pthread_mutex_unlock(&s->lock);
+
+  while (x < 0)
+    { v    = -1;
+      most = 0;
+      for (n = 0; n < NSTEAL; n++)
+        { s = STEAL + n;
+          pthread_mutex_lock(&s->lock);
+          if (s->last - s->next > most)
+            { most = s->last - s->next;
+              v    = n;
+            }
+          pthread_mutex_unlock(&s->lock);
+        }
+      if (v < 0)
+        return (-1);
+
+      s = STEAL + v;
+      pthread_mutex_lock(&s->lock);
+      if (s->next < s->last)
+        x = --s->last;
+      pthread_mutex_unlock(&s->lock);
+    }
+  return (x);
+}
 
-  int      x;
+static void *sort_thread(void *arg) 
+{ Steal *own   = (Steal *) arg;
+  Range *rng   = own->rng;
+  int    t     = own - STEAL;
+  int64 *khist = rng->khist;
+  int64 *phist;
+
+  int      x, k;
   int64    alive[256];
 
   if (KSIZE <= 0)
     return (NULL);
 
   for (x = 0; x < 256; x++)
-    alive[x] = khist[x] = 0;
+    alive[x] = 0;
 
   if (INIT_COUNTS)
     { for (x = 0; x < 0x8000; x++)
-        count[x] = 0;
-      param->max_inst = 0;
+        rng->count[x] = 0;
+      rng->max_inst = 0;
     }
 
-  for (x = beg; x < end; x++)
+  while ((x = take_bucket(t)) >= 0)
     { if (PARTS[x] == 0)
         continue;
 
 #ifdef SHOW_STUFF
-      printf("Thread %3d: %12lld - %12lld\n",x,off,off+PARTS[x]);
+      printf("Thread %3d: %12lld - %12lld\n",t,BOFF[x],BOFF[x]+PARTS[x]);
 #endif
 
-      param->byte1 = x;
-      radix_sort(ARRAY + off, PARTS[x], 1, alive, param);
+      for (k = 0; k < 256; k++)
+        khist[k] = 0;
+      rng->byte1 = x;
+      if ( ! (hash_worthy(PARTS[x],1,own) && hash_bucket(ARRAY+BOFF[x],PARTS[x],1,own,alive)))
+        radix_sort(ARRAY + BOFF[x], PARTS[x], 1, alive, own);
+
+      phist = PANEL[OWNER[x]].khist;
+      pthread_mutex_lock(&STEAL[OWNER[x]].lock);
+      for (k = 0; k < 256; k++)
+        phist[k] += khist[k];
+      pthread_mutex_unlock(&STEAL[OWNER[x]].lock);
+    }
 
-      off += PARTS[x];
+  if (INIT_COUNTS)
+    { memcpy(PANEL[t].count,rng->count,sizeof(int64)*0x8000);
+      PANEL[t].max_inst = rng->max_inst;
     }
 
   return (NULL);
@@ -305,22 +557,21 @@ static void *sort_thread(void *arg)
 
 static void msd_sort(uint8 *array, int64 nelem, int rsize, int ksize,
                      int64 *part, int nthreads, Range *parms)
-{
-#ifndef SHOW_STUFF
-  pthread_t     threads[nthreads];
-#endif
-
-  int   x, n, beg;
-  int64 sum, thr, off;
-  int64 asize;
+{ Range *scratch;
+  int    x, n, beg;
+  int64  sum, thr, off;
+  int64  asize;
 
   asize = nelem*rsize;
 
   ARRAY = array;
+  PANEL = parms;
   PARTS = part;
   RSIZE = rsize;
   KSIZE = ksize;
 
+  net_setup();
+
   S_thr0 = THR0*RSIZE;
   S_thr1 = THR1*RSIZE;
   S_thr2 = THR2*RSIZE;
@@ -333,7 +584,9 @@ static void msd_sort(uint8 *array, int64 nelem, int rsize, int ksize,
   sum = 0;
   beg = 0;
   for (x = 0; x < 256; x++)
-    { sum += part[x];
+    { BOFF[x]  = sum;
+      OWNER[x] = n;
+      sum += part[x];
       if (sum >= thr)
         { parms[n].end = x+1;
           parms[n].beg = beg;
@@ -351,19 +604,49 @@ static void msd_sort(uint8 *array, int64 nelem, int rsize, int ksize,
       n += 1;
     }
 
+  STEAL   = (Steal *) Malloc(sizeof(Steal)*nthreads,"Allocating sort panels");
+  scratch = (Range *) Malloc(sizeof(Range)*nthreads,"Allocating sort panels");
+  if (STEAL == NULL || scratch == NULL)
+    exit (1);
+  NSTEAL = nthreads;
+  for (n = 0; n < nthreads; n++)
+    { STEAL[n].next = parms[n].beg;
+      STEAL[n].last = parms[n].end;
+      STEAL[n].rng  = scratch + n;
+      STEAL[n].hash = HASH_COUNT;
+      if (HASH_COUNT)
+        { STEAL[n].first = (int64 *) Malloc(sizeof(int64)*2*HASH_MAX
+                                              + sizeof(int)*(HASH_SLOTS+HASH_MAX),
+                                            "Allocating hash tables");
+          if (STEAL[n].first == NULL)
+            exit (1);
+          STEAL[n].wgt  = STEAL[n].first + HASH_MAX;
+          STEAL[n].slot = (int *) (STEAL[n].wgt + HASH_MAX);
+          STEAL[n].sidx = STEAL[n].slot + HASH_SLOTS;
+          for (x = 0; x < HASH_SLOTS; x++)
+            STEAL[n].slot[x] = -1;
+        }
+      pthread_mutex_init(&STEAL[n].lock,NULL);
+      if (KSIZE > 0)
+        for (x = 0; x < 256; x++)
+          parms[n].khist[x] = 0;
+    }
+
 #ifdef SHOW_STUFF
   for (x = 0; x < nthreads; x++)
-    sort_thread(parms+x);
+    sort_thread(STEAL+x);
 #else
-  for (x = 1; x < nthreads; x++)
-    pthread_create(threads+x,NULL,sort_thread,parms+x);
-
-  sort_thread(parms);
-
-  for (x = 1; x < nthreads; x++)
-    pthread_join(threads[x],NULL);
+  Run_Pool(sort_thread,STEAL,sizeof(Steal),nthreads);
 #endif
 
+  for (n = 0; n < nthreads; n++)
+    { pthread_mutex_destroy(&STEAL[n].lock);
+      if (HASH_COUNT)
+        free(STEAL[n].first);
+    }
+  free(scratch);
+  free(STEAL);
+
 #ifdef IS_SORTED
   sum = 0;
   for (x = 0; x < 256; x++)
@@ -463,6 +746,7 @@ void Supermer_Sort(uint8 *array, int64 nelem, int rsize, int ksize,
     RSHIFT = 8;
   COUNT = count_smers;
   INIT_COUNTS = 0;
+  HASH_COUNT  = 0;
 
 #ifdef DEBUG_CANONICAL
   { char *t;
@@ -540,5 +824,7 @@ void Weighted_Kmer_Sort(uint8 *array, int64 nelem, int rsize, int ksize,
   else
     COUNT = hist_kmers;
   INIT_COUNTS = 1;
+  HASH_COUNT  = ( ! DO_PROFILE);  //  Counts can be summed out of order only if no profiles
+  HASH_SIZE   = nelem*rsize;
   return (msd_sort(array,nelem,rsize,ksize,part,nthreads,panel));
 }
@@ -23,8 +23,15 @@ int   VERBOSE;
 int   NTHREADS;
 char *SORT_PATH;
 
+int   NUMA_NODES = 1;   //  The threads of LSD_Sort are not pinned here
+
+void  Pin_Thread(int t) { (void) t; }
+void  Unpin_Thread() { }
+
 static char *Usage = " [-v] [-T<int(4)>] [-P<dir(/tmp)] <source_root>[.ktab] <dest_root>[.ktab]";
 
+#define READ_AHEAD 0x400000   //  Bytes of each stream buffer when reading sequentially
+
 
 /****************************************************************************************
  *
@@ -521,6 +528,7 @@ int main(int argc, char *argv[])
   }
 
   T = Open_Kmer_Stream(argv[1]);
+  Readahead_Kmer_Stream(T,READ_AHEAD);
 
   nblocks = T->nels / ((0x100000000 / T->tbyte));
 
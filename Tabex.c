@@ -18,6 +18,8 @@
 
 static char *Usage = "[-t<int>] <source_root>[.ktab] (LIST|CHECK|(k-mer:string>) ...";
 
+#define READ_AHEAD 0x400000   //  Bytes of each stream buffer when reading sequentially
+
 static int Check_Kmer_Table(Kmer_Table *T)
 { char *curs, *last, *flip;
   int64 i;
@@ -98,6 +100,7 @@ int main(int argc, char *argv[])
   Kmer_Stream *S;
   int          CUT;
   int          STREAM;
+  int          MAPPED;
 
   { int    i, j, k;
     int    flags[128];
@@ -114,7 +117,7 @@ int main(int argc, char *argv[])
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("T")
+            ARG_FLAGS("TM")
             break;
           case 't':
             ARG_POSITIVE(CUT,"Cutoff for k-mer table")
@@ -125,6 +128,7 @@ int main(int argc, char *argv[])
     argc = j;
 
     STREAM = ! flags['T'];   //  This is undocumented and only for developer use.
+    MAPPED = flags['M'];     //    as is this (map the table with -T, if no -t)
 
     if (argc < 3)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -142,6 +146,7 @@ int main(int argc, char *argv[])
         { fprintf(stderr,"%s: Cannot open %s\n",Prog_Name,argv[1]);
           exit (1);
         } 
+      Readahead_Kmer_Stream(S,READ_AHEAD);
     
       printf("Opening %d-mer table with ",S->kmer);
       Print_Number(S->nels,0,stdout);
@@ -181,7 +186,10 @@ int main(int argc, char *argv[])
   //  But for developers and illustrative purposes we also give a Kmer_Table implementation
 
   else
-    { T = Load_Kmer_Table(argv[1],CUT);
+    { if (MAPPED && CUT == 0)
+        T = Map_Kmer_Table(argv[1],0);
+      else
+        T = Load_Kmer_Table(argv[1],CUT);
       if (T == NULL)
         { fprintf(stderr,"%s: Cannot open %s\n",Prog_Name,argv[1]);
           exit (1);
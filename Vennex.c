@@ -18,9 +18,12 @@
 #undef DEBUG_PARTITION
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 
 static char *Usage = "[-h[<int(1)>:]<int(100)>] <source_1>[.ktab] <source_2>[.ktab] ...";
 
+#define READ_AHEAD 0x10000000   //  Bytes of stream buffers over all tables
+
 /****************************************************************************************
  *
  *  Print & compare utilities
@@ -30,14 +33,6 @@ static char *Usage = "[-h[<int(1)>:]<int(100)>] <source_1>[.ktab] <source_2>[.kt
 
 #define  COUNT_OF(p) (*((uint16 *) (p+kbyte)))
 
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n-- > 0)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
 /****************************************************************************************
  *
  *  Find Venn Histograms
@@ -270,6 +265,7 @@ int main(int argc, char *argv[])
             { fprintf(stderr,"%s: K-mer tables do not involve the same K\n",Prog_Name);
               exit (1);
             }
+          Readahead_Kmer_Stream(T[c],READ_AHEAD/(2*nway));
         }
     }
 
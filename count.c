@@ -6,10 +6,10 @@
  *       * Sort the k-mers from each super-mer weighted by the # of times that super-mer occurs.
  *       * During the 2nd sort accumulate the histogram of k-mer frequencies.
  *            Output this to <source_root>.K<kmer>.
- *       * if requesteda (-t) produce a table of all the k-mers with counts >= -t in NTHREADSs
- *            pieces in files SORT_PATH/<root>.<bucket>.L<thread>
+ *       * if requesteda (-t) produce a table of all the k-mers with counts >= -t in NTABLES
+ *            pieces in files <-P dir>/<root>.<bucket>.L<thread>
  *       * if requested (-p) invert the first two sorts to produce a profile for every super-mer
- *            in the order in the source in files SORT_PATH/<root>.<bucket>.P<thread>.[0-3]
+ *            in the order in the source in files <-P dir>/<root>.<bucket>.P<thread>.[0-3]
  *       * if requested (-h) print the histogram of k-mer frequencies.
  *
  *  Author:  Gene Myers
@@ -24,11 +24,14 @@
 #include <dirent.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 
 #include "libfastk.h"
 #include "FastK.h"
 
+#include "LIBDEFLATE/libdeflate.h"
+
 #undef  DEBUG_COMPRESS
 #undef  DEBUG_SLIST
 #undef  DEBUG_KLIST
@@ -41,6 +44,8 @@
 #undef    SHOW_RUN
 #undef  DEBUG_PWRITE
 
+#define HUGE_ARENA     //  Back the sort arena with transparent huge pages (if available)
+
 #define THREAD  pthread_t
 
 
@@ -155,11 +160,13 @@ static int  Runer_Reload[IO_UBITS+1];
 static int *Super_Reload[IO_UBITS+1];
 
 typedef struct
-  { int     tfile;      //  Bit compressed super-mer input streaam for thread
-    int64   nmers;      //  # of super-mers in the input
-    int64   nbase;      //  if DO_PROFILE then start of indices for this thread
-    int64   nidxs;      //  total number of super-mers for this thread slice
-    uint8  *fours[256]; //  finger for filling list sorted on first super-mer byte
+  { int       tfile;      //  Bit compressed super-mer input streaam for thread
+    IO_UTYPE *core;       //  If IN_CORE then the bit compressed super-mers are here instead
+    int64     clen;       //    and are this many words long
+    int64     nmers;      //  # of super-mers in the input
+    int64     nbase;      //  if DO_PROFILE then start of indices for this thread
+    int64     nidxs;      //  total number of super-mers for this thread slice
+    uint8    *fours[256]; //  finger for filling list sorted on first super-mer byte
   } Slist_Arg;
 
 static void *supermer_list_thread(void *arg)
@@ -188,9 +195,15 @@ static void *supermer_list_thread(void *arg)
   int    bit, clen; 
   int64  k;
 
-  read(in,iobuf,IO_UBYTES*IO_BUF_LEN);
-  ioend = iobuf + IO_BUF_LEN;
-  ptr   = iobuf;
+  if (data->core != NULL)            //  Entire list is in memory with IO_BUF_LEN words of
+    { ptr   = data->core;              //    padding, so the reload tests below never fire
+      ioend = ptr + data->clen + IO_BUF_LEN;
+    }
+  else
+    { read(in,iobuf,IO_UBYTES*IO_BUF_LEN);
+      ioend = iobuf + IO_BUF_LEN;
+      ptr   = iobuf;
+    }
   bit   = IO_UBITS;
   rbits = 17;
   rlim  = 0x10000ll;
@@ -313,6 +326,122 @@ static void *supermer_list_thread(void *arg)
 }
 
 
+/*******************************************************************************************
+ *
+ * static void *part_load_thread(Load_Arg *arg)
+ *     Read the super-mer files of a part into memory and remove them.  Run in the background
+ *     while the previous part is being sorted so that reading a part overlaps with computing
+ *     on its predecessor.  If ZIP_SMERS, the files are a series of compressed blocks that
+ *     are inflated as they are read.
+ *
+ ********************************************************************************************/
+
+typedef struct
+  { char      *root;    //  Root name of super-mer files
+    int        part;    //  Part to load
+    Core_List *list;    //  Result: list[t] for t in [0,ITHREADS) is the super-mer list of thread t
+  } Load_Arg;
+
+  //  Inflate the zsize bytes of compressed super-mer blocks of file f (named fname) into
+  //    a list returned with its length in words in *dlen (padded by IO_BUF_LEN words)
+
+static IO_UTYPE *unzip_supers(int f, char *fname, int64 zsize, int64 *dlen)
+{ struct libdeflate_decompressor *unzip;
+  uint32    len[2];
+  uint8    *zbuf;
+  int64     zmax;
+  IO_UTYPE *data;
+  int64     dmax, dtop;
+  size_t    ulen;
+
+  unzip = libdeflate_alloc_decompressor();
+  zmax  = 2*IO_BUF_LEN*IO_UBYTES;
+  dmax  = zsize/IO_UBYTES + 2*IO_BUF_LEN;
+  zbuf  = Malloc(zmax,"Allocating decompression buffer");
+  data  = Malloc(dmax*IO_UBYTES,"Allocating super-mer list");
+  if (unzip == NULL || zbuf == NULL || data == NULL)
+    Clean_Exit(1);
+
+  dtop = 0;
+  while (read(f,len,2*sizeof(uint32)) == 2*sizeof(uint32))
+    { if (len[1] > zmax)
+        { zmax = 1.2*len[1] + 1000;
+          zbuf = Realloc(zbuf,zmax,"Allocating decompression buffer");
+          if (zbuf == NULL)
+            Clean_Exit(1);
+        }
+      if (dtop + len[0]/IO_UBYTES + IO_BUF_LEN > dmax)
+        { dmax = 1.5*dmax + len[0]/IO_UBYTES + IO_BUF_LEN;
+          data = Realloc(data,dmax*IO_UBYTES,"Allocating super-mer list");
+          if (data == NULL)
+            Clean_Exit(1);
+        }
+      if (read(f,zbuf,len[1]) != len[1] ||
+          libdeflate_deflate_decompress(unzip,zbuf,len[1],data+dtop,len[0],&ulen) != 0 ||
+          ulen != len[0])
+        { fprintf(stderr,"\n%s: Compressed super-mer file %s is corrupted\n",Prog_Name,fname); 
+          Clean_Exit(1);
+        }
+      dtop += len[0]/IO_UBYTES;
+    }
+
+  libdeflate_free_decompressor(unzip);
+  free(zbuf);
+
+  *dlen = dtop;
+  return (data);
+}
+
+static void *part_load_thread(void *arg)
+{ Load_Arg   *data = (Load_Arg *) arg;
+  Core_List  *list;
+  char       *fname;
+  struct stat info;
+  int64       len;
+  int         t, f;
+
+  fname = Malloc(SORT_PLEN + strlen(data->root) + 100,"File name buffer");
+  list  = Malloc(sizeof(Core_List)*ITHREADS,"Allocating super-mer lists");
+  if (fname == NULL || list == NULL)
+    Clean_Exit(1);
+
+  for (t = 0; t < ITHREADS; t++)
+    { sprintf(fname,"%s/%s.%d.T%d",Sort_Path(data->part,t),data->root,data->part,t);
+      f = open(fname,O_RDONLY);
+      if (f < 0 || fstat(f,&info) < 0)
+        { fprintf(stderr,"\n%s: File %s should exist but doesn't?\n",Prog_Name,fname); 
+          Clean_Exit(1);
+        }
+
+      read(f,&(list[t].kmers),sizeof(int64));
+      read(f,&(list[t].nmers),sizeof(int64));
+      read(f,list[t].fours,sizeof(int64)*256);
+
+      if (ZIP_SMERS)
+        list[t].data = unzip_supers(f,fname,info.st_size - 258*sizeof(int64),&len);
+      else
+        { len = (info.st_size - 258*sizeof(int64)) / IO_UBYTES;
+          list[t].data = Malloc((len+IO_BUF_LEN)*IO_UBYTES,"Allocating super-mer list");
+          if (list[t].data == NULL)
+            Clean_Exit(1);
+          if (Big_Read(f,list[t].data,len*IO_UBYTES) != len*IO_UBYTES)
+            { fprintf(stderr,"\n%s: Could not read all of %s\n",Prog_Name,fname); 
+              Clean_Exit(1);
+            }
+        }
+      list[t].dlen = len;
+
+      close(f);
+      if (CHECKPOINT == NULL)
+        unlink(fname);
+    }
+
+  free(fname);
+  data->list = list;
+  return (NULL);
+}
+
+
 /*******************************************************************************************
  *
  * static void *kmer_list_thread(Klist_Arg *arg)
@@ -1008,13 +1137,14 @@ static void *profile_list_thread(void *arg)
  *
  * static void *profile_write_thread(Pwrite_Arg *arg)
  *     Each thread takes the now "un"sorted list of pointers to profile fragments and
- *     outputs them to a "P" file in the SORT_PATH directory.
+ *     outputs them to a "P" file in the -P directory of its part and thread.
  *
  ********************************************************************************************/
 
 typedef struct
   { uint8    *sort;
     char     *root;
+    int       part;
     int       wch;
     int64     beg;
     int64     end;
@@ -1054,7 +1184,7 @@ static void *profile_write_thread(void *arg)
 #endif
 #endif
 
-  fname = Malloc(strlen(data->root) + 100,"File Name");
+  fname = Malloc(SORT_PLEN + strlen(data->root) + 100,"File Name");
   bend  = bufr + (0x10000 - (RUN_BYTES+PLEN_BYTES+2*MAX_SUPER+2));
 
   psort = data->sort + beg*PROF_BYTES;
@@ -1064,7 +1194,8 @@ static void *profile_write_thread(void *arg)
 #ifdef DEBUG_PWRITE
       printf("Panel %d\n",t);
 #endif
-      sprintf(fname,"%s%d.%d",data->root,data->wch,t-1);
+      sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(data->part,data->wch),
+                                     data->root,data->part,data->wch,t-1);
       pfile = open(fname,O_WRONLY|O_CREAT|O_TRUNC,S_IRWXU|S_IRWXG|S_IRWXO);
       if (pfile < 0)
         { fprintf(stderr,"\n%s: Could not open %s for writing\n",Prog_Name,fname);
@@ -1181,6 +1312,257 @@ static void *profile_write_thread(void *arg)
 }
 
 
+/*******************************************************************************************
+ *
+ * void Start_Pool(), void Run_Pool(task,args,size,n), void Stop_Pool()
+ *     Sorting runs many short threaded steps per part.  Rather than creating and joining
+ *     threads for each, NTHREADS-1 workers are created once by Start_Pool.  Run_Pool has
+ *     worker w (the caller being worker 0) call task(args + t*size) for the t in [0,n) with
+ *     t = w mod NTHREADS, and returns when all n calls are done.  A worker is pinned to the
+ *     node of sort thread w for its life (see Pin_Thread), and the caller while it runs
+ *     its tasks.  Steps whose work is skewed balance it themselves by having the n tasks take
+ *     finer units of work from each other (e.g. the byte buckets of the MSD sorts).
+ *
+ ********************************************************************************************/
+
+static struct
+  { THREAD         *threads;   //  NTHREADS-1 workers (worker t is threads[t-1])
+    pthread_mutex_t lock;
+    pthread_cond_t  go;        //  Signalled when a new step (round) is posted or on stop
+    pthread_cond_t  done;      //  Signalled when the last worker finishes a step
+    int             round;     //  # of steps posted so far
+    int             busy;      //  # of workers yet to finish the current step
+    int             stop;
+    void         *(*task)(void *);
+    uint8          *args;
+    int             size;
+    int             ntask;
+  } Pool;
+
+static void *pool_thread(void *arg)
+{ int    t = (int) ((int64) arg);
+  int    round, i;
+  void *(*task)(void *);
+
+  Pin_Thread(t);
+
+  round = 0;
+  while (1)
+    { pthread_mutex_lock(&Pool.lock);
+      while (Pool.round == round && ! Pool.stop)
+        pthread_cond_wait(&Pool.go,&Pool.lock);
+      if (Pool.stop)
+        { pthread_mutex_unlock(&Pool.lock);
+          break;
+        }
+      round = Pool.round;
+      task  = Pool.task;
+      pthread_mutex_unlock(&Pool.lock);
+
+      for (i = t; i < Pool.ntask; i += NTHREADS)
+        task(Pool.args + i*Pool.size);
+
+      pthread_mutex_lock(&Pool.lock);
+      if (--Pool.busy == 0)
+        pthread_cond_signal(&Pool.done);
+      pthread_mutex_unlock(&Pool.lock);
+    }
+  return (NULL);
+}
+
+void Start_Pool()
+{ int64 t;
+
+  Pool.threads = Malloc(sizeof(THREAD)*NTHREADS,"Allocating thread pool");
+  if (Pool.threads == NULL)
+    Clean_Exit(1);
+  pthread_mutex_init(&Pool.lock,NULL);
+  pthread_cond_init(&Pool.go,NULL);
+  pthread_cond_init(&Pool.done,NULL);
+  Pool.round = 0;
+  Pool.busy  = 0;
+  Pool.stop  = 0;
+  for (t = 1; t < NTHREADS; t++)
+    pthread_create(Pool.threads+(t-1),NULL,pool_thread,(void *) t);
+}
+
+void Run_Pool(void *(*task)(void *), void *args, int size, int n)
+{ int i;
+
+  pthread_mutex_lock(&Pool.lock);
+  Pool.task  = task;
+  Pool.args  = (uint8 *) args;
+  Pool.size  = size;
+  Pool.ntask = n;
+  Pool.busy  = NTHREADS-1;
+  Pool.round += 1;
+  pthread_cond_broadcast(&Pool.go);
+  pthread_mutex_unlock(&Pool.lock);
+
+  Pin_Thread(0);
+  for (i = 0; i < n; i += NTHREADS)
+    task(((uint8 *) args) + i*size);
+  Unpin_Thread();
+
+  pthread_mutex_lock(&Pool.lock);
+  while (Pool.busy > 0)
+    pthread_cond_wait(&Pool.done,&Pool.lock);
+  pthread_mutex_unlock(&Pool.lock);
+}
+
+void Stop_Pool()
+{ int t;
+
+  pthread_mutex_lock(&Pool.lock);
+  Pool.stop = 1;
+  pthread_cond_broadcast(&Pool.go);
+  pthread_mutex_unlock(&Pool.lock);
+  for (t = 1; t < NTHREADS; t++)
+    pthread_join(Pool.threads[t-1],NULL);
+  pthread_cond_destroy(&Pool.done);
+  pthread_cond_destroy(&Pool.go);
+  pthread_mutex_destroy(&Pool.lock);
+  free(Pool.threads);
+}
+
+
+/*******************************************************************************************
+ *
+ * static uint8 *sort_arena(int64 size)
+ *     Return a buffer of at least size bytes for the weighted k-mer, count/index, and profile
+ *     link lists of a part.  The address space for the largest part possible (KMAX & NMAX)
+ *     is mapped once, and if HUGE_ARENA is defined backed by transparent huge pages.  It is
+ *     then faulted in by NTHREADS threads in parallel up to the high-water mark of the parts
+ *     so far, so that a part only pays for the pages of its excess over the previous ones,
+ *     and not for first touching all its pages in the sorts.  The weighted k-mers of a part
+ *     are usually much fewer than its k-mers, so only the mark is ever resident.
+ *
+ *     On a NUMA machine the faulting workers are pinned as the sort workers are, and worker
+ *     t touches the t'th panel of the NTHREADS equal panels of the request, so that the
+ *     pages a sort thread works on are on its node.  The super-mer sort array is placed
+ *     in the same way when it is allocated.
+ *
+ ********************************************************************************************/
+
+static uint8 *Arena      = NULL;   //  Mapped region of Arena_Size bytes
+static int64  Arena_Size = 0;
+static int64  Arena_Mark = 0;      //  [0,Arena_Mark) of the region have been faulted in
+
+typedef struct
+  { uint8 *beg;
+    uint8 *end;
+    int64  page;
+  } Fault_Arg;
+
+static void *prefault_thread(void *arg)
+{ Fault_Arg *data = (Fault_Arg *) arg;
+  int64      page = data->page;
+  volatile uint8 *x;
+
+  for (x = data->beg; x < data->end; x += page)
+    *x = 0;
+  return (NULL);
+}
+
+  //  Fault in bytes [mark,size) of base in parallel.  With more than one node thread t takes
+  //    those in its panel of [0,size), otherwise [mark,size) is divided evenly.
+
+static void fault_pages(uint8 *base, int64 mark, int64 size)
+{ Fault_Arg parm[NTHREADS];
+  int64     page, npages, b, e;
+  int       t;
+
+  page   = sysconf(_SC_PAGESIZE);
+  npages = (size+page-1)/page;
+  for (t = 0; t < NTHREADS; t++)
+    { if (NUMA_NODES > 1)
+        { b = ((npages*t)/NTHREADS)*page;
+          e = ((npages*(t+1))/NTHREADS)*page;
+          if (b < mark)
+            b = mark;
+          if (e < b)
+            e = b;
+        }
+      else
+        { b = mark + (((size-mark)/page*t)/NTHREADS)*page;
+          e = mark + (((size-mark)/page*(t+1))/NTHREADS)*page;
+          if (t == NTHREADS-1)
+            e = size;
+        }
+      parm[t].beg  = base + b;
+      parm[t].end  = base + e;
+      parm[t].page = page;
+    }
+  Run_Pool(prefault_thread,parm,sizeof(Fault_Arg),NTHREADS);
+}
+
+static void map_arena(int64 size)
+{ int64 page;
+
+  if (Arena != NULL)
+    munmap(Arena,Arena_Size);
+
+  page = sysconf(_SC_PAGESIZE);
+  size = ((size+page-1)/page)*page;
+
+  Arena = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+  if (Arena == MAP_FAILED)
+    { fprintf(stderr,"%s: Out of memory (Mapping sort arena)\n",Prog_Name);
+      Arena = NULL;
+      Arena_Size = 0;
+      Clean_Exit(1);
+    }
+#if defined(HUGE_ARENA) && defined(MADV_HUGEPAGE)
+  madvise(Arena,size,MADV_HUGEPAGE);
+#endif
+  Arena_Size = size;
+  Arena_Mark = 0;
+}
+
+static uint8 *sort_arena(int64 size)
+{ int64 page;
+
+  if (size > Arena_Size)
+    map_arena(size);
+
+  if (size > Arena_Mark)
+    { page = sysconf(_SC_PAGESIZE);
+      size = ((size+page-1)/page)*page;
+      fault_pages(Arena,Arena_Mark,size);
+      Arena_Mark = size;
+    }
+
+  return (Arena);
+}
+
+static void free_arena()
+{ if (Arena != NULL)
+    munmap(Arena,Arena_Size);
+  Arena      = NULL;
+  Arena_Size = 0;
+  Arena_Mark = 0;
+}
+
+  //  Arena bytes for a part of kmers weighted k-mers and nmers super-mers.  If profiling
+  //    (cword > 0) the k-mer and count/index lists are side by side, and then the count/index
+  //    list is followed by the double-buffered profile link list.
+
+#define ARENA_ALIGN(x)  (((x)+7) & ~((int64) 7))
+
+static int64 arena_size(int64 kmers, int64 nmers, int cword)
+{ int64 size, plen;
+
+  if (cword == 0)
+    return (kmers*KMER_WORD+1);
+
+  size = kmers*(KMER_WORD+cword)+2;
+  plen = ARENA_ALIGN(kmers*cword) + nmers*PROF_BYTES*2;
+  if (plen > size)
+    size = plen;
+  return (size);
+}
+
+
 /*********************************************************************************************\
  *
  *  Sorting(char *path, char *root)
@@ -1191,14 +1573,19 @@ static void *profile_write_thread(void *arg)
  *       * Sort the k-mers from each super-mer weighted by the # of times that super-mer occurs.
  *       * During the 2nd sort accumulate the histogram of k-mer frequencies.
  *            Output this to <source_root>.K<kmer>.
- *       * if requesteda (-t) produce a table of all the k-mers with counts >= -t in NTHREADSs
- *            pieces in files SORT_PATH/<root>.<bucket>.L<thread>
+ *       * if requesteda (-t) produce a table of all the k-mers with counts >= -t in NTABLES
+ *            pieces in files <-P dir>/<root>.<bucket>.L<thread>
  *       * if requested (-p) invert the first two sorts to produce a profile for every super-mer
- *            in the order in the source in files SORT_PATH/<root>.<bucket>.P<thread>.[0-3]
+ *            in the order in the source in files <-P dir>/<root>.<bucket>.P<thread>.[0-3]
  *       * if requested (-h) print the histogram of k-mer frequencies.
  *
  *********************************************************************************************/
 
+  //  The histogram & table state of the parts sorted in the passes of a disk-budgeted run (-D)
+  //    made so far, carried to the call of Sorting for the next pass
+
+static Checkpoint Pass_State;
+
 void Sorting(char *path, char *root)
 { char  *fname;
   int64  counts[0x8000];
@@ -1206,11 +1593,15 @@ void Sorting(char *path, char *root)
   int   *reload;
 
   if (VERBOSE)
-    { fprintf(stderr,"\nPhase 2: Sorting & Counting K-mers in %d blocks\n\n",NPARTS);
+    { if (PASS_END-PASS_BEG < NPARTS)
+        fprintf(stderr,"\nPhase 2: Sorting & Counting K-mers in blocks %d-%d of %d\n\n",
+                       PASS_BEG+1,PASS_END,NPARTS);
+      else
+        fprintf(stderr,"\nPhase 2: Sorting & Counting K-mers in %d blocks\n\n",NPARTS);
       fflush(stderr);
     }
 
-  fname = Malloc(2*(strlen(SORT_PATH) + strlen(path) + strlen(root)) + 100,"File name buffer");
+  fname = Malloc(2*(SORT_PLEN + strlen(path) + strlen(root)) + 100,"File name buffer");
   if (fname == NULL)
     Clean_Exit(1);
 
@@ -1270,23 +1661,26 @@ void Sorting(char *path, char *root)
   { Slist_Arg  *parms = Malloc(sizeof(Slist_Arg)*ITHREADS,"Allocating sort controls");
     Klist_Arg  *parmk = Malloc(sizeof(Klist_Arg)*NTHREADS,"Allocating sort controls");
     Clist_Arg  *parmc = Malloc(sizeof(Clist_Arg)*NTHREADS,"Allocating sort controls");
-    Twrite_Arg *parmt = Malloc(sizeof(Twrite_Arg)*NTHREADS,"Allocating sort controls");
+    Twrite_Arg *parmt = Malloc(sizeof(Twrite_Arg)*NTABLES,"Allocating sort controls");
     Plist_Arg  *parmp = Malloc(sizeof(Plist_Arg)*NTHREADS,"Allocating sort controls");
     Pwrite_Arg *parmw = Malloc(sizeof(Pwrite_Arg)*ITHREADS,"Allocating sort controls");
 
-    int   *Table_Split = Malloc(sizeof(int)*NTHREADS,"Allocating sort controls");
+    int   *Table_Split = Malloc(sizeof(int)*NTABLES,"Allocating sort controls");
     int64 *Sparts      = Malloc(sizeof(int64)*256,"Allocating sort controls");
     int64 *Kparts      = Malloc(sizeof(int64)*256,"Allocating sort controls");
     Range *Panels      = Malloc(sizeof(Range)*NTHREADS,"Allocating sort controls");
+    int64 *Shist       = Malloc(sizeof(int64)*256*ITHREADS,"Allocating sort controls");
     int64 *Wkmers      = Malloc(sizeof(int64)*NPARTS,"Allocating sort controls");
     int64 *Ukmers      = Malloc(sizeof(int64)*NPARTS,"Allocating sort controls");
 
-#if !defined(DEBUG) || !defined(SHOW_RUN)
-    THREAD *threads = Malloc(sizeof(THREAD)*NTHREADS,"Allocating sort controls");
-#endif
-
     int         ODD_PASS = 0;
 
+    Core_List  *clist;    //  Super-mer lists of the current part if in memory
+#ifndef DEVELOPER
+    Load_Arg    load;     //  Background load of the next part's super-mer files
+    THREAD      loader;
+#endif
+
     uint8      *s_sort;
     uint8      *k_sort;
     uint8      *i_sort;
@@ -1298,6 +1692,8 @@ void Sorting(char *path, char *root)
     int64  skmers;
     int64  tmers;
     int    t, p;
+    int    pfirst;
+    Checkpoint *carry;
 
     s_sort = NULL;
     i_sort = NULL;
@@ -1307,13 +1703,10 @@ void Sorting(char *path, char *root)
       Clean_Exit(1);
 
     if (Table_Split == NULL || Sparts == NULL || Kparts == NULL ||
-        Panels == NULL || Wkmers == NULL || Ukmers == NULL)
+        Panels == NULL || Shist == NULL || Wkmers == NULL || Ukmers == NULL)
       Clean_Exit(1);
 
-#if !defined(DEBUG) || !defined(SHOW_RUN)
-    if (threads == NULL)
-      Clean_Exit(1);
-#endif
+    Start_Pool();
 
 #ifndef DEVELOPER
     if (DO_PROFILE)
@@ -1327,12 +1720,62 @@ void Sorting(char *path, char *root)
     s_sort = Malloc((NMAX+1)*SMER_WORD+1,"Allocating super-mer sort array");
     if (s_sort == NULL)
       Clean_Exit(1);
+    if (NUMA_NODES > 1)
+      fault_pages(s_sort,0,(NMAX+1)*SMER_WORD+1);
     *s_sort++ = 0;
+
+    //  Map the arena for the k-mer lists of the largest part possible now (no part has more
+    //    than KMAX weighted k-mers or NMAX super-mers)
+
+    if (DO_PROFILE)
+      map_arena(arena_size(KMAX,NMAX,CMER_WORD));
+    else
+      map_arena(arena_size(KMAX,NMAX,0));
 #endif
 
-    tmers = 0;
-    for (p = 0; p < NPARTS; p++)
+    //  If resuming from a checkpoint, or sorting the parts of a pass after the first, then
+    //    restore the histogram and table state of the parts already completed, and start
+    //    with the next one
+
+    if (DISK_BUDGET > 0)
+      carry = &Pass_State;
+    else
+      carry = CHECKPOINT;
+
+    tmers  = 0;
+    pfirst = PASS_BEG;
+    if (carry != NULL && carry->parts > 0)
+      { pfirst   = carry->parts;
+        tmers    = carry->tmers;
+        max_inst = carry->max_inst;
+        memcpy(counts,carry->counts,sizeof(int64)*0x8000);
+        memcpy(Table_Split,carry->split,sizeof(int)*NTABLES);
+        memcpy(Wkmers,carry->wkmers,sizeof(int64)*pfirst);
+        memcpy(Ukmers,carry->ukmers,sizeof(int64)*pfirst);
+      }
+
+    for (p = pfirst; p < PASS_END; p++)
       {
+        //  Get super-mer lists of part p if in memory, either because everything fits
+        //    in a single part, or because they were loaded while sorting part p-1.
+
+        if (IN_CORE)
+          clist = CORE_LIST;
+#ifndef DEVELOPER
+        else if (p > pfirst)
+          { pthread_join(loader,NULL);
+            clist = load.list;
+          }
+        else if (ZIP_SMERS)
+          { load.root = root;
+            load.part = p;
+            part_load_thread(&load);
+            clist = load.list;
+          }
+#endif
+        else
+          clist = NULL;
+
         //  Open and reada headers of super-mer files for part p
 
         kmers = 0;
@@ -1341,7 +1784,19 @@ void Sorting(char *path, char *root)
           { int64 k, n;
             int   f;
 
-            sprintf(fname,"%s/%s.%d.T%d",SORT_PATH,root,p,t);
+            if (clist != NULL)
+              { parms[t].tfile = -1;
+                parms[t].core  = clist[t].data;
+                parms[t].clen  = clist[t].dlen;
+                parms[t].nidxs = NUM_RID[t];
+                parms[t].nmers = clist[t].nmers;
+                kmers += clist[t].kmers;
+                nmers += clist[t].nmers;
+                memcpy(Shist+256*t,clist[t].fours,sizeof(int64)*256);
+                continue;
+              }
+
+            sprintf(fname,"%s/%s.%d.T%d",Sort_Path(p,t),root,p,t);
             f = open(fname,O_RDONLY);
             if (f < 0)
               { fprintf(stderr,"\n%s: File %s should exist but doesn't?\n",Prog_Name,fname); 
@@ -1349,6 +1804,7 @@ void Sorting(char *path, char *root)
               }
 
             parms[t].tfile = f;
+            parms[t].core  = NULL;
 #ifdef DEVELOPER
             read(f,&KMAX,sizeof(int64));
             read(f,&NMAX,sizeof(int64));
@@ -1365,7 +1821,7 @@ void Sorting(char *path, char *root)
             kmers += k;
             nmers += n;
 
-            read(f,Panels[t].khist,sizeof(int64)*256);
+            read(f,Shist+256*t,sizeof(int64)*256);
           }
 
 #ifdef DEVELOPER
@@ -1403,7 +1859,7 @@ void Sorting(char *path, char *root)
           for (j = 0; j < 256; j++)
             for (t = 0; t < ITHREADS; t++)
               { parms[t].fours[j] = s_sort + o*SMER_WORD;
-                o += Panels[t].khist[j];
+                o += Shist[256*t+j];
               }
 
           o = 0;
@@ -1418,20 +1874,32 @@ void Sorting(char *path, char *root)
         for (t = 0; t < ITHREADS; t++)
           supermer_list_thread(parms+t);
 #else
-        for (t = 1; t < ITHREADS; t++)
-          pthread_create(threads+t,NULL,supermer_list_thread,parms+t);
-	supermer_list_thread(parms);
-        for (t = 1; t < ITHREADS; t++)
-          pthread_join(threads[t],NULL);
+        Run_Pool(supermer_list_thread,parms,sizeof(Slist_Arg),ITHREADS);
 #endif
 
-        for (t = 0; t < ITHREADS; t++)
-          close(parms[t].tfile);
+        if (clist != NULL)
+          { for (t = 0; t < ITHREADS; t++)
+              free(clist[t].data);
+            free(clist);
+          }
+        else
+          { for (t = 0; t < ITHREADS; t++)
+              close(parms[t].tfile);
 
 #ifndef DEVELOPER
-        for (t = 0; t < ITHREADS; t++)
-          { sprintf(fname,"%s/%s.%d.T%d",SORT_PATH,root,p,t);
-            unlink(fname);
+            if (CHECKPOINT == NULL)
+              for (t = 0; t < ITHREADS; t++)
+                { sprintf(fname,"%s/%s.%d.T%d",Sort_Path(p,t),root,p,t);
+                  unlink(fname);
+                }
+#endif
+          }
+
+#ifndef DEVELOPER
+        if (!IN_CORE && p+1 < PASS_END)
+          { load.root = root;
+            load.part = p+1;
+            pthread_create(&loader,NULL,part_load_thread,&load);
           }
 #endif
 
@@ -1474,24 +1942,24 @@ void Sorting(char *path, char *root)
           skmers = o;
         }
 
+        Wkmers[p] = skmers;
+        Ukmers[p] = kmers;
         if (VERBOSE)
           { fprintf(stderr,"\r  Processing block %d: Sorting weighted k-mers",p+1); 
-            Wkmers[p] = skmers;
-            Ukmers[p] = kmers;
             fflush(stderr);
           }
 
         if (DO_PROFILE)
           if (ODD_PASS)
-            { i_sort = Malloc(skmers*(CMER_WORD+KMER_WORD)+2,"Weighted k-mer & inverse list");
+            { i_sort = sort_arena(arena_size(skmers,nmers,CMER_WORD));
               k_sort = i_sort + skmers*CMER_WORD + 1;
             }
           else
-            { k_sort = Malloc(skmers*(KMER_WORD+CMER_WORD)+2,"Weighted k-mer & inverse list");
+            { k_sort = sort_arena(arena_size(skmers,nmers,CMER_WORD));
               i_sort = k_sort + skmers*KMER_WORD + 1;
             }
         else
-          k_sort = Malloc(skmers*KMER_WORD+1,"Weighted k-mer list");
+          k_sort = sort_arena(arena_size(skmers,nmers,0));
 
         for (t = 0; t < NTHREADS; t++)
           { int j;
@@ -1509,11 +1977,7 @@ void Sorting(char *path, char *root)
         for (t = 0; t < NTHREADS; t++)
           kmer_list_thread(parmk+t);
 #else
-        for (t = 1; t < NTHREADS; t++)
-          pthread_create(threads+t,NULL,kmer_list_thread,parmk+t);
-	kmer_list_thread(parmk);
-        for (t = 1; t < NTHREADS; t++)
-          pthread_join(threads[t],NULL);
+        Run_Pool(kmer_list_thread,parmk,sizeof(Klist_Arg),NTHREADS);
 #endif
 
         //  Sort weighted k-mer list
@@ -1547,39 +2011,57 @@ void Sorting(char *path, char *root)
 
         if (DO_TABLE > 0)
           {
-            //  Threaded write of sorted kmer+count table
-            //    1st time determine partition bytes values.  Therafter, spit on said
+            //  Threaded write of sorted kmer+count table into NTABLES parts
+            //    1st time determine partition bytes values as the sort does its panels (so
+            //    they are the same when NTABLES = NTHREADS).  Therafter, spit on said
 
             if (p == 0)
-              { for (t = 0; t < NTHREADS; t++)
-                  { Table_Split[t] = Panels[t].beg;
-                    parmt[t].off = Panels[t].off;
-                  }
-              }
-            else
-              { int64 off;
-                int   beg;
+              { int64 asize, sum, thr;
+                int   x, n, beg;
+
+                asize = 0;
+                for (x = 0; x < 256; x++)
+                  asize += Kparts[x];
 
-                off = 0;
+                n   = 0;
+                thr = asize / NTABLES;
+                sum = 0;
                 beg = 0;
-                for (t = 0; t < NTHREADS; t++)
-                  { while (beg < Table_Split[t])
-                      { off += Kparts[beg];
-                        beg += 1;
+                for (x = 0; x < 256 && n < NTABLES; x++)
+                  { sum += Kparts[x];
+                    if (sum >= thr)
+                      { Table_Split[n++] = beg;
+                        thr = (asize * (n+1))/NTABLES;
+                        beg = x+1;
                       }
-                    parmt[t].off = off;
                   }
+                while (n < NTABLES)
+                  Table_Split[n++] = 256;
               }
 
-            for (t = 0; t < NTHREADS; t++)
+            { int64 off;
+              int   beg;
+
+              off = 0;
+              beg = 0;
+              for (t = 0; t < NTABLES; t++)
+                { while (beg < Table_Split[t])
+                    { off += Kparts[beg];
+                      beg += 1;
+                    }
+                  parmt[t].off = off;
+                }
+            }
+
+            for (t = 0; t < NTABLES; t++)
               { parmt[t].sort  = k_sort;
                 parmt[t].parts = Kparts;
                 parmt[t].beg   = Table_Split[t];
-                if (t < NTHREADS-1)
+                if (t < NTABLES-1)
                   parmt[t].end  = Table_Split[t+1];
                 else
                   parmt[t].end = 256;
-                sprintf(fname,"%s/%s.%d.L%d",SORT_PATH,root,p,t);
+                sprintf(fname,"%s/%s.%d.L%d",Sort_Path(p,t),root,p,t);
                 parmt[t].kfile = open(fname,O_WRONLY|O_CREAT|O_TRUNC,S_IRWXU|S_IRWXG|S_IRWXO);
                 parmt[t].kname = Strdup(fname,"Allocating stream name");
                 if (parmt[t].kname == NULL)
@@ -1597,17 +2079,13 @@ void Sorting(char *path, char *root)
 #endif
 
 #ifdef DEBUG_TABOUT
-            for (t = 0; t < NTHREADS; t++)
+            for (t = 0; t < NTABLES; t++)
               table_write_thread(parmt+t);
 #else
-            for (t = 1; t < NTHREADS; t++)
-              pthread_create(threads+t,NULL,table_write_thread,parmt+t);
-	    table_write_thread(parmt);
-            for (t = 1; t < NTHREADS; t++)
-              pthread_join(threads[t],NULL);
+            Run_Pool(table_write_thread,parmt,sizeof(Twrite_Arg),NTABLES);
 #endif
 
-            for (t = 0; t < NTHREADS; t++)
+            for (t = 0; t < NTABLES; t++)
               tmers += parmt[t].tmers;
 
             if (p == NPARTS-1)
@@ -1627,16 +2105,14 @@ void Sorting(char *path, char *root)
 #endif
               }
  
-            for (t = 0; t < NTHREADS; t++)
+            for (t = 0; t < NTABLES; t++)
               { free(parmt[t].kname);
                 close(parmt[t].kfile);
               }
           }
 
         if (! DO_PROFILE)
-	  { free(k_sort);
-            continue;
-          }
+          goto part_done;
 
         if (VERBOSE)
           { fprintf(stderr,"\r  Processing block %d: Inverse profile sorting",p+1); 
@@ -1674,7 +2150,7 @@ void Sorting(char *path, char *root)
           {
             // Relative profile: also set up table file for merges
 
-            sprintf(fname,"%s/%s.U%d",SORT_PATH,root,p);
+            sprintf(fname,"%s/%s.U%d",Sort_Path(p,0),root,p);
             parmc[0].stm = Open_Kmer_Stream(fname);
             if (parmc[0].stm == NULL)
               { fprintf(stderr,"\n%s: Table %s should exist but doesn't?\n",Prog_Name,fname); 
@@ -1687,19 +2163,17 @@ void Sorting(char *path, char *root)
             for (t = 0; t < NTHREADS; t++)
               cmer_merge_thread(parmc+t);
 #else
-            for (t = 1; t < NTHREADS; t++)
-              pthread_create(threads+t,NULL,cmer_merge_thread,parmc+t);
-            cmer_merge_thread(parmc);
-            for (t = 1; t < NTHREADS; t++)
-              pthread_join(threads[t],NULL);
+            Run_Pool(cmer_merge_thread,parmc,sizeof(Clist_Arg),NTHREADS);
 #endif
 
             Free_Kmer_Stream(parmc[0].stm);
 
 #ifndef DEVELOPER
-            sprintf(fname,"rm -f %s/%s.U%d.ktab %s/.%s.U%d.ktab.*",
-                          SORT_PATH,root,p,SORT_PATH,root,p);
-            system(fname);
+            if (CHECKPOINT == NULL)
+              { sprintf(fname,"rm -f %s/%s.U%d.ktab %s/.%s.U%d.ktab.*",
+                              Sort_Path(p,0),root,p,Sort_Path(p,0),root,p);
+                system(fname);
+              }
 #endif
           }
 
@@ -1709,15 +2183,12 @@ void Sorting(char *path, char *root)
             for (t = 0; t < NTHREADS; t++)
               cmer_list_thread(parmc+t);
 #else
-            for (t = 1; t < NTHREADS; t++)
-              pthread_create(threads+t,NULL,cmer_list_thread,parmc+t);
-            cmer_list_thread(parmc);
-            for (t = 1; t < NTHREADS; t++)
-              pthread_join(threads[t],NULL);
+            Run_Pool(cmer_list_thread,parmc,sizeof(Clist_Arg),NTHREADS);
 #endif
           }
 
-        //  LSD sort count/index list on index and then tidy up memory
+        //  LSD sort count/index list on index, the parity of the # of passes (ODD_PASS)
+        //    is such that the result is at the start of the arena
 
         { int i, x;
           int bytes[KMAX_BYTES+1];
@@ -1728,17 +2199,12 @@ void Sorting(char *path, char *root)
           bytes[x] = -1;
 
           i_sort = LSD_Sort(skmers,i_sort,k_sort,CMER_WORD,bytes);
-
-          if (ODD_PASS)
-            i_sort = Realloc(i_sort,skmers*CMER_WORD,"Pruning count list");
-          else
-            i_sort = Realloc(k_sort,skmers*CMER_WORD,"Pruning count list");
         }
 
         //  Use i_sort & k_sort again to build list of compressed profile fragments
-        //    in place in i_sort, and build reference list
+        //    in place in i_sort, and build reference list in the arena after i_sort
 
-        p_sort = Malloc(nmers*PROF_BYTES*2,"Allocating profile link array");
+        p_sort = i_sort + ARENA_ALIGN(skmers*CMER_WORD);
 
         for (t = 0; t < NTHREADS; t++)
           { parmp[t].sort   = s_sort;
@@ -1755,11 +2221,7 @@ void Sorting(char *path, char *root)
         for (t = 0; t < NTHREADS; t++)
           profile_list_thread(parmp+t);
 #else
-        for (t = 1; t < NTHREADS; t++)
-          pthread_create(threads+t,NULL,profile_list_thread,parmp+t);
-        profile_list_thread(parmp);
-        for (t = 1; t < NTHREADS; t++)
-          pthread_join(threads[t],NULL);
+        Run_Pool(profile_list_thread,parmp,sizeof(Plist_Arg),NTHREADS);
 #endif
 
         //  LSD sort profile links on super-mer idx
@@ -1779,7 +2241,6 @@ void Sorting(char *path, char *root)
 
         { int64 o;
 
-          sprintf(fname,"%s/%s.%d.P",SORT_PATH,root,p);
           o = 0;
           for (t = 0; t < ITHREADS; t++)
             { parmw[t].sort  = a_sort;
@@ -1791,7 +2252,8 @@ void Sorting(char *path, char *root)
               printf("Partition %2d: %10lld [%lld]\n",t,o,nmers);
 #endif
               parmw[t].prol  = i_sort;
-              parmw[t].root  = fname;
+              parmw[t].root  = root;
+              parmw[t].part  = p;
               parmw[t].wch   = t;
             }
         }
@@ -1800,20 +2262,73 @@ void Sorting(char *path, char *root)
         for (t = 0; t < ITHREADS; t++)
           profile_write_thread(parmw+t);
 #else
-        for (t = 1; t < ITHREADS; t++)
-          pthread_create(threads+t,NULL,profile_write_thread,parmw+t);
-        profile_write_thread(parmw);
-        for (t = 1; t < ITHREADS; t++)
-          pthread_join(threads[t],NULL);
+        Run_Pool(profile_write_thread,parmw,sizeof(Pwrite_Arg),ITHREADS);
 #endif
 
-	free(p_sort);
-	free(i_sort);
+      part_done:
+
+        //  If checkpointing then record that part p is complete, and only now remove its inputs
+
+        if (CHECKPOINT != NULL)
+          { CHECKPOINT->parts    = p+1;
+            CHECKPOINT->tmers    = tmers;
+            CHECKPOINT->max_inst = max_inst;
+            CHECKPOINT->wkmers[p] = Wkmers[p];
+            CHECKPOINT->ukmers[p] = Ukmers[p];
+            memcpy(CHECKPOINT->counts,counts,sizeof(int64)*0x8000);
+            memcpy(CHECKPOINT->split,Table_Split,sizeof(int)*NTABLES);
+            Save_Checkpoint(1);
+
+            for (t = 0; t < ITHREADS; t++)
+              { sprintf(fname,"%s/%s.%d.T%d",Sort_Path(p,t),root,p,t);
+                unlink(fname);
+              }
+            if (PRO_TABLE != NULL)
+              { sprintf(fname,"rm -f %s/%s.U%d.ktab %s/.%s.U%d.ktab.*",
+                              Sort_Path(p,0),root,p,Sort_Path(p,0),root,p);
+                system(fname);
+              }
+          }
       }
 
     free(s_sort-1);
+    free_arena();
 
-    if (VERBOSE)
+    //  If there are passes to come then hand the state over to the next one, and undo the
+    //    widening of the sort records by the sizes of this pass
+
+    if (PASS_END < NPARTS)
+      { if (Pass_State.split == NULL)
+          { Pass_State.split  = Malloc(sizeof(int)*NTABLES,"Allocating pass state");
+            Pass_State.wkmers = Malloc(sizeof(int64)*2*NPARTS,"Allocating pass state");
+            if (Pass_State.split == NULL || Pass_State.wkmers == NULL)
+              Clean_Exit(1);
+            Pass_State.ukmers = Pass_State.wkmers + NPARTS;
+          }
+        Pass_State.parts    = PASS_END;
+        Pass_State.tmers    = tmers;
+        Pass_State.max_inst = max_inst;
+        memcpy(Pass_State.counts,counts,sizeof(int64)*0x8000);
+        memcpy(Pass_State.split,Table_Split,sizeof(int)*NTABLES);
+        memcpy(Pass_State.wkmers,Wkmers,sizeof(int64)*PASS_END);
+        memcpy(Pass_State.ukmers,Ukmers,sizeof(int64)*PASS_END);
+        if (VERBOSE)
+          { fprintf(stderr,"\r                                               \r");
+            fflush(stderr);
+          }
+#ifndef DEVELOPER
+        if (DO_PROFILE)
+          { KMER_WORD -= KMAX_BYTES;
+            SMER_WORD -= RUN_BYTES;
+          }
+#endif
+      }
+    else if (Pass_State.split != NULL)
+      { free(Pass_State.wkmers);
+        free(Pass_State.split);
+      }
+
+    if (VERBOSE && PASS_END == NPARTS)
       { int64  wtot, utot;
         double psav;
         int    wwide, awide;
@@ -1862,12 +2377,11 @@ void Sorting(char *path, char *root)
         fflush(stderr);
       }
 
-#if !defined(DEBUG) || !defined(SHOW_RUN)
-    free(threads);
-#endif
+    Stop_Pool();
 
     free(Ukmers);
     free(Wkmers);
+    free(Shist);
     free(Panels);
     free(Kparts);
     free(Sparts);
@@ -1883,7 +2397,7 @@ void Sorting(char *path, char *root)
 
   //  Output histogram
 
-  if (PRO_TABLE == NULL)
+  if (PRO_TABLE == NULL && PASS_END == NPARTS)
     { int   i, f;
 
       sprintf(fname,"%s/%s.hist",path,root);
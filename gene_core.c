@@ -155,6 +155,28 @@ char *Numbered_Suffix(char *left, int num, char *right)
 }
 
 
+//  Reads over 2GB don't work on some systems, patch to overcome said
+
+int64 Big_Read(int f, void *buffer, int64 bytes)
+{ uint8 *buf = (uint8 *) buffer;
+  int64  v, x;
+
+  v = 0;
+  while (bytes > 0x70000000)
+    { x = read(f,buf,0x70000000);
+      if (x < 0)
+        return (-1);
+      v += x;
+      bytes -= 0x70000000;
+      buf   += 0x70000000;
+    }
+  x = read(f,buf,bytes);
+  if (x < 0)
+    return (-1);
+  return (v+x);
+}
+
+
 #define  COMMA  ','
 
 //  Print big integers with commas/periods for better readability
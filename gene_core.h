@@ -101,6 +101,9 @@ char *Numbered_Suffix(char *left, int num, char *right);
 void Print_Number(int64 num, int width, FILE *out);   //  Print readable big integer
 int  Number_Digits(int64 num);                        //  Return # of digits in printed number
 
+int64 Big_Read(int f, void *buffer, int64 bytes);     //  read() in pieces as reads over 2GB
+                                                      //    don't work on some systems
+
 /*******************************************************************************************
  *
  *  ROUTINES FOR HANDLING DNA AND ARROW STRINGS
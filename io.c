@@ -85,8 +85,10 @@ typedef struct
     int64      fsize;  //  Size of file in bytes
     int        ftype;  //  Type of file
     int        zipd;   //  Is file gzip'd
+    int        bgzf;   //  Is file a BGZF (blocked gzip) file
+    int        temp;   //  path is an uncompressed copy in SORT_PATH
 
-    int64      zsize;  //  Size of compression index for cram and dazz
+    int64      zsize;  //  Size of compression index for cram, dazz, and indexed bgzf
     int64     *zoffs;  //  zoffs[i] = offset to compressed block i
     int        DB_all; //  Trim parameters for Dazzler DB's
     int        DB_cut;
@@ -133,6 +135,64 @@ static void do_nothing(Thread_Arg *parm)
 static int64 *genes_cram_index(char *path, int64 fsize, int64 *zsize);
 static void   read_DB_stub(char *path, int *cut, int *all);
 static int64 *get_dazz_offsets(FILE *idx, int64 *zsize);
+static int64 *read_bgzf_index(char *path, int64 fsize, int64 *zsize);
+
+  //  A BGZF file is a series of gzip members each of which has an extra 'BC' subfield
+  //    giving its compressed size.  Look at the header of the first member.
+
+static int is_bgzf(int fid)
+{ uint8 head[18];
+  int   bgzf;
+
+  bgzf = (read(fid,head,18) == 18 && head[0] == 31 && head[1] == 139 && head[2] == 8
+                                  && head[3] == 4 && head[12] == 'B' && head[13] == 'C'
+                                  && head[14] == 2 && head[15] == 0);
+  lseek(fid,0,SEEK_SET);
+  return (bgzf);
+}
+
+  //  Uncompress the gzip'd file path into the file temp
+
+static void gunzip_file(char *path, char *temp)
+{ gzFile gzid;
+  uint8 *buf;
+  int    out, len;
+
+  buf = Malloc(IO_BLOCK,"Allocating gunzip buffer");
+  if (buf == NULL)
+    Clean_Exit(1);
+
+  gzid = gzopen(path,"r");
+  if (gzid == NULL)
+    { fprintf(stderr,"\n%s: Cannot open %s\n",Prog_Name,path);
+      Clean_Exit(1);
+    }
+  gzbuffer(gzid,0x100000);
+
+  out = open(temp,O_WRONLY|O_CREAT|O_TRUNC,S_IRWXU);
+  if (out < 0)
+    { fprintf(stderr,"\n%s: Cannot create %s\n",Prog_Name,temp);
+      Clean_Exit(1);
+    }
+
+  while ((len = gzread(gzid,buf,IO_BLOCK)) > 0)
+    if (write(out,buf,len) != len)
+      { fprintf(stderr,"\n%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,temp);
+        close(out);
+        unlink(temp);
+        Clean_Exit(1);
+      }
+  if (len < 0)
+    { fprintf(stderr,"\n%s: Corrupted gzip file %s\n",Prog_Name,path);
+      close(out);
+      unlink(temp);
+      Clean_Exit(1);
+    }
+
+  close(out);
+  gzclose_r(gzid);
+  free(buf);
+}
 
 static void Fetch_File(char *arg, File_Object *input, int gz_ok)
 { static char *suffix[] = { ".cram", ".bam", ".sam", ".db", ".dam",
@@ -148,7 +208,7 @@ static void Fetch_File(char *arg, File_Object *input, int gz_ok)
   char  *pwd, *root, *path, *temp;
   int    fid, i;
   int64  fsize, zsize, *zoffs;
-  int    ftype, zipd;
+  int    ftype, zipd, bgzf;
 
   pwd = PathTo(arg);
   for (i = 0; i < 17; i++)
@@ -174,31 +234,28 @@ static void Fetch_File(char *arg, File_Object *input, int gz_ok)
   path = Strdup(Catenate(pwd,"/",root,extend[i]),"Allocating full path name");
 
   zoffs = NULL;
+  temp  = NULL;
+  bgzf  = 0;
   if (zipd)
-    { if (gz_ok)
-        { if (stat(path,&stats) == -1)
-            { fprintf(stderr,"\n%s: Cannot get stats for %s\n",Prog_Name,path);
-              Clean_Exit(1);
-            }
-          fsize = stats.st_size;
-          zsize = (fsize-1)/IO_BLOCK+1;
-        }
-      else
+    { bgzf = is_bgzf(fid);
+      if ( ! (gz_ok || bgzf))
         { if (VERBOSE)
             fprintf(stderr,"  Gzipped file %s being temporarily uncompressed\n",arg);
           temp = Strdup(Catenate(SORT_PATH,"/",root,extend[i]),"Allocating full path name");
           temp[strlen(temp)-3] = '\0';
-          system(Catenate("gunzip -c ",path," >",temp));
+          gunzip_file(path,temp);
           free(path);
           path = temp;
           zipd  = 0;
-          if (stat(path,&stats) == -1)
-            { fprintf(stderr,"\n%s: Cannot get stats for %s\n",Prog_Name,path);
-              Clean_Exit(1);
-            }
-          fsize = stats.st_size;
-          zsize = (fsize-1)/IO_BLOCK+1;
         }
+      if (stat(path,&stats) == -1)
+        { fprintf(stderr,"\n%s: Cannot get stats for %s\n",Prog_Name,path);
+          Clean_Exit(1);
+        }
+      fsize = stats.st_size;
+      zsize = (fsize-1)/IO_BLOCK+1;
+      if (bgzf)
+        zoffs = read_bgzf_index(path,fsize,&zsize);
     }
   else if (ftype == DAZZ)
     { FILE *idx;
@@ -241,8 +298,8 @@ static void Fetch_File(char *arg, File_Object *input, int gz_ok)
     }
 
 #ifdef DEBUG_FIND
-  fprintf(stderr,"\n%s is a %s file, ftype = %d, zipd = %d, fsize = %lld\n",
-                 arg,suffix[i],ftype,zipd,fsize);
+  fprintf(stderr,"\n%s is a %s file, ftype = %d, zipd = %d, bgzf = %d, fsize = %lld\n",
+                 arg,suffix[i],ftype,zipd,bgzf,fsize);
 #endif
 
   close(fid);
@@ -253,12 +310,14 @@ static void Fetch_File(char *arg, File_Object *input, int gz_ok)
   input->fsize = fsize;
   input->ftype = ftype;
   input->zipd  = zipd;
+  input->bgzf  = bgzf;
+  input->temp  = (temp != NULL);
   input->zsize = zsize;
   input->zoffs = zoffs;
 }
 
-static void Free_File(File_Object *input, int gz_ok)
-{ if (!gz_ok && input->zipd)
+static void Free_File(File_Object *input)
+{ if (input->temp)
     unlink(input->path);
   free(input->zoffs);
   free(input->path);
@@ -266,11 +325,13 @@ static void Free_File(File_Object *input, int gz_ok)
   free(input->pwd);
 }
 
+  //  Remove the temporary uncompressed copies of the first n files (on an error exit)
+
 static void Free_Gunzips( File_Object *input, int n)
 { int i;
 
   for (i = 0; i < n; i++)
-    if (input[i].zipd)
+    if (input[i].temp)
       unlink(input[i].path);
 }
 
@@ -377,6 +438,379 @@ static void Reset_Data_Block(DATA_BLOCK *dset, int roll)
 }
 
 
+/*******************************************************************************************
+ *
+ *  Routines to manage a BAM_FILE stream object.  A BAM file is a BGZF file, i.e. a series
+ *    of gzip blocks each holding at most 64KB of data, so the same stream object is also
+ *    used to read BGZF compressed fasta and fastq files.
+ *
+ ********************************************************************************************/
+
+#define BAM_BLOCK  0x10000
+
+ //  Get value of little endian integer of n-bytes
+
+static inline uint32 getint(uint8 *buf, int n)
+{ uint32 val;
+  int    k;
+
+  val = 0;
+  for (k = n-1; k >= 0; k--)
+    val = (val << 8) | buf[k];
+  return (val);
+}
+
+  //   Open BAM stream where compressed block start is known.  Compressed BAM blocks are buffered
+  //     in a very big IO buffer and the current uncompressed block is in a 64Kbp array.
+
+typedef struct
+  { int       fid;              //  file descriptor
+    int       last;             //  last block of data in file has been read
+    uint8    *buf;              //  IO buffer (of IO_BLOCK bytes, supplied by caller)
+    int       blen;             //  # of bytes currently in IO buffer
+    int       bptr;             //  start of next BAM block in IO buffer
+    uint8     bam[BAM_BLOCK+1]; //  uncompressed bam block
+    uint32    bsize;            //  length of compressed bam block
+    uint32    ssize;            //  length of uncompressed bam block
+    Location  loc;              //  current location in bam file
+    DEPRESS  *decomp;
+  } BAM_FILE;
+
+  //  Load and uncompress the next block at file->bptr into file->bam
+
+static void bam_load(BAM_FILE *file)
+{ int    bptr, blen, bsize, chk;
+  uint8 *block, *buf;
+  size_t tsize;
+
+  buf   = file->buf;
+  bptr  = file->bptr;
+  blen  = file->blen;
+  block = buf+bptr;
+#ifdef DEBUG_BAM_IO
+  printf("Block at buffer %d\n",bptr);
+#endif
+  while (bptr + 18 > blen || bptr + (bsize = getint(block+16,2) + 1) > blen)
+    { chk = blen-bptr;
+      if (file->last)
+        { fprintf(stderr,"\n%s: Corrupted BAM file\n",Prog_Name);
+          Clean_Exit(1);
+        }
+      memmove(buf,block,chk);
+      blen = chk + read(file->fid,buf+chk,IO_BLOCK-chk);
+#ifdef DEBUG_BAM_IO
+      printf("Loaded %d to buf+%d for a total of %d\n",IO_BLOCK-chk,chk,blen);
+#endif
+      if (blen < IO_BLOCK)
+        file->last = 1;
+      file->blen = blen;
+      bptr = 0;
+      block = buf;
+    }
+
+  //  Fetch and uncompress next Bam block
+
+  if (libdeflate_gzip_decompress(file->decomp,block,bsize,file->bam,BAM_BLOCK,&tsize) != 0)
+    { fprintf(stderr,"\n%s: Bad gzip block\n",Prog_Name);
+      Clean_Exit(1);
+    }
+#ifdef DEBUG_BAM_IO
+  printf("Loaded gzip block of size %d into %d\n",bsize,(int) tsize);
+#endif
+
+  file->bsize = bsize;
+  file->ssize = tsize;
+  file->bptr  = bptr + bsize;
+}
+
+  //  Load next len bytes of uncompressed BAM data into array data
+
+static void bam_get(BAM_FILE *file, uint8 *data, int len)
+{ int    chk, off;
+  uint8 *bam  = file->bam;
+  int    boff = file->loc.boff;
+
+  off = 0;
+  chk = file->ssize - boff;
+  while (len >= chk)
+    {
+#ifdef DEBUG_BAM_IO
+      printf("Move %d bytes to data+%d from bam+%d\n",chk,off,boff);
+#endif
+      if (data != NULL)
+        memcpy(data+off,bam+boff,chk);
+      off += chk;
+      len -= chk;
+
+      file->loc.fpos += file->bsize;
+#ifdef DEBUG_BAM_IO
+      printf("File pos %lld\n",file->fpos);
+#endif
+
+      if (chk == 0 && len == 0)
+        { file->loc.boff = 0;
+          return;
+        }
+
+      bam_load(file);
+      boff = 0;
+      chk  = file->ssize;
+    }
+
+#ifdef DEBUG_BAM_IO
+  printf("Xfer %d bytes to data+%d from bam+%d\n",len,off,boff);
+#endif
+  if (data != NULL)
+    memcpy(data+off,bam+boff,len);
+  file->loc.boff = boff+len;
+}
+
+  //  Startup a bam stream, the location must be valid.
+
+static void bam_start(BAM_FILE *file, int fid, uint8 *buf, Location *loc)
+{ file->fid   = fid;
+  file->ssize = 0;
+  file->bsize = 0;
+  file->buf   = buf;
+  file->bptr  = 0;
+  file->blen  = 0;
+  file->last  = 0;
+  lseek(fid,loc->fpos,SEEK_SET);
+  file->loc.fpos = loc->fpos;
+  file->loc.boff = 0;
+  bam_get(file,NULL,loc->boff);
+}
+
+static int bam_eof(BAM_FILE *file)
+{ return (file->loc.boff == file->ssize && file->bptr == file->blen && file->last); }
+
+  //  Advance a BGZF stream to the start of its next block, returning 0 if there is none
+
+static int bgzf_next(BAM_FILE *file)
+{ if (file->bptr == file->blen && file->last)
+    return (0);
+  file->loc.fpos += file->bsize;
+  file->loc.boff  = 0;
+  bam_load(file);
+  return (1);
+}
+
+  //  If bgzip -i left an index path.gzi then return the offsets of all the blocks in the
+  //    file in an array of size *zsize+1, the last element being fsize.  Otherwise (or if
+  //    the index does not look like it belongs to the file) return NULL.
+
+static int64 *read_bgzf_index(char *path, int64 fsize, int64 *zsize)
+{ FILE  *gzi;
+  uint64 n, i, pair[2];
+  uint8  head[4];
+  int64 *zoffs;
+  int    fid;
+
+  gzi = fopen(Catenate(path,"",".gzi",""),"r");
+  if (gzi == NULL)
+    return (NULL);
+
+  zoffs = NULL;
+  if (fread(&n,sizeof(uint64),1,gzi) != 1 || n >= (uint64) fsize/18)
+    goto no_index;
+
+  zoffs = Malloc(sizeof(int64)*(n+2),"Allocating bgzf index");
+  if (zoffs == NULL)
+    Clean_Exit(1);
+
+  zoffs[0] = 0;
+  for (i = 1; i <= n; i++)                   //  Entries are (compressed, uncompressed) offset
+    { if (fread(pair,sizeof(uint64),2,gzi) != 2)    //    pairs of all blocks but the first
+        goto no_index;
+      zoffs[i] = pair[0];
+      if (zoffs[i] <= zoffs[i-1] || zoffs[i] >= fsize)
+        goto no_index;
+    }
+  zoffs[n+1] = fsize;
+
+  fid = open(path,O_RDONLY);                  //  The last block must be where the index says
+  if (pread(fid,head,4,zoffs[n]) != 4 || head[0] != 31 || head[1] != 139)
+    { close(fid);
+      goto no_index;
+    }
+  close(fid);
+  fclose(gzi);
+
+  *zsize = n+1;
+  return (zoffs);
+
+no_index:
+  if (VERBOSE)
+    fprintf(stderr,"  Ignoring index %s.gzi that does not match its file\n",path);
+  free(zoffs);
+  fclose(gzi);
+  return (NULL);
+}
+
+  //  Start the stream bam at the first block at or after parm->beg.fpos in parm->fid using
+  //    the .gzi index in zoffs[0..zsize).  Returns 0 if there is no such block.
+
+static int bgzf_index_block(Thread_Arg *parm, BAM_FILE *bam, int64 *zoffs, int64 zsize)
+{ Location loc;
+  int64    l, r, m;
+
+  l = 0;
+  r = zsize;
+  while (l < r)
+    { m = (l+r)/2;
+      if (zoffs[m] < parm->beg.fpos)
+        l = m+1;
+      else
+        r = m;
+    }
+  if (l >= zsize)
+    return (0);
+
+  loc.fpos = zoffs[l];
+  loc.boff = 0;
+  bam->decomp = parm->decomp;
+  bam_start(bam,parm->fid,parm->buf,&loc);
+  return (bgzf_next(bam));
+}
+
+  //  Find the first BGZF block at or after parm->beg.fpos in parm->fid and start the
+  //    stream bam at it.  Returns 0 if there is no such block.
+
+static int bgzf_find_block(Thread_Arg *parm, BAM_FILE *bam)
+{ uint8       *buf  = parm->buf;
+  int          fid  = parm->fid;
+  DEPRESS     *decomp = parm->decomp;
+  int64        fpos = parm->beg.fpos;
+
+  uint32 bptr, blen;
+  int    last, notfound;
+
+  uint8 *block;
+  uint32 bsize, ssize;
+  size_t tsize;
+
+#ifdef DEBUG_FIND
+  fprintf(stderr,"Searching from %lld\n",fpos);
+  fflush(stderr);
+#endif
+
+  lseek(fid,fpos,SEEK_SET);
+  blen = 0;
+  bptr = 0;
+  last = 0;
+
+  //  Search until find a gzip block header
+
+  notfound = 1;
+  while (notfound)
+    { int    j;
+      uint32 isize, crc;
+
+      fpos += bptr;      //   Get more data at level of IO blocks
+      if (last)
+        return (0);
+      else
+        { uint32 x = blen-bptr;
+          memmove(buf,buf+bptr,x);
+          blen = x + read(fid,buf+x,IO_BLOCK-x);
+          if (blen < IO_BLOCK)
+            last = 1;
+#ifdef DEBUG_FIND
+          fprintf(stderr,"Loading %d(last=%d)\n",blen,last);
+          fflush(stderr);
+#endif
+          bptr = 0;
+        }
+
+      while (bptr < blen)          //  Search IO block for Gzip block start
+        { if (buf[bptr++] != 31)
+            continue;
+          if ( buf[bptr] != 139)
+            continue;
+          bptr += 1;
+          if ( buf[bptr] != 8)
+            continue;
+          bptr += 1;
+          if ( buf[bptr] != 4)
+            continue;
+  
+#ifdef DEBUG_FIND
+          fprintf(stderr,"  Putative header @ %d\n",bptr-3);
+          fflush(stderr);
+#endif
+
+          if (bptr + 12 > blen)
+            { if (last)
+                continue;
+              bptr -= 3;
+              break;
+            }
+  
+          j = bptr+9;
+          if (buf[j] != 66)
+		  continue;
+          j += 1;
+          if (buf[j] != 67)
+            continue;
+          j += 1;
+          if (buf[j] != 2)
+            continue;
+          j += 1;
+          if (buf[j] != 0)
+            continue;
+          j += 1;
+    
+          bsize = getint(buf+j,2)+1;
+          block = buf+(bptr-3);
+
+          if ((bptr-3) + bsize > blen)
+            { if (last)
+                continue;
+              bptr -= 3;
+              break;
+            }
+
+#ifdef DEBUG_FIND
+          fprintf(stderr,"    Putative Extra %d\n",bsize);
+          fflush(stderr);
+#endif
+  
+          isize = getint(block+(bsize-4),4);
+          crc   = getint(block+(bsize-8),4);
+  
+          if (libdeflate_gzip_decompress(decomp,block,bsize,bam->bam,BAM_BLOCK,&tsize) != 0)
+            continue;
+          ssize = tsize;
+
+          if (ssize == isize && crc == libdeflate_crc32(0,bam->bam,ssize))
+            { bptr -= 3;
+              fpos  += bptr;
+              notfound = 0;
+
+#ifdef DEBUG_FIND
+              fprintf(stderr,"    First block at %lld (%d)\n",fpos,ssize);
+              fflush(stderr);
+#endif
+	      break;
+            }
+        }
+    }
+
+  bam->fid      = fid;      //  Kick-start BAM stream object
+  bam->last     = last;
+  bam->buf      = buf;
+  bam->blen     = blen;
+  bam->bptr     = bptr+bsize;
+  bam->bsize    = bsize;
+  bam->ssize    = ssize;
+  bam->loc.fpos = fpos;
+  bam->loc.boff = 0;
+  bam->decomp   = decomp;
+
+  return (1);
+}
+
+
 /*******************************************************************************************
  *
  *  FASTA / FASTQ SPECIFIC CODE
@@ -412,21 +846,41 @@ static void fast_nearest(Thread_Arg *data)
   uint8       *buf    = data->buf;
   File_Object *inp    = data->fobj + data->bidx;
   int          fastq = (inp->ftype == FASTQ);
+  int          bgzf  = inp->bgzf;
 
-  int64 blk, off;
-  int   slen;
-  int   state;
-  int   nl_1, nl_2, pl_1, alive;
-  int   b, c;
+  BAM_FILE  _bam, *bam = &_bam;
+
+  int64  blk, off;
+  int    slen;
+  int    state;
+  int    nl_1, nl_2, pl_1, alive;
+  int    b, c;
+  uint8 *dat;
 
 #ifdef DEBUG_FIND
   fprintf(stderr,"\nFind starting at %lld\n",beg);
 #endif
 
-  blk = beg / IO_BLOCK;
-  off = beg % IO_BLOCK;
+  blk = off = 0;
+  if (bgzf)              //  Start at the first BGZF block at or after beg
+    { int found;
+
+      if (inp->zoffs != NULL)
+        found = bgzf_index_block(data,bam,inp->zoffs,inp->zsize);
+      else
+        found = bgzf_find_block(data,bam);
+      if ( ! found)
+        { data->beg.fpos = -1;
+          data->beg.boff = 0;
+          return;
+        }
+    }
+  else
+    { blk = beg / IO_BLOCK;
+      off = beg % IO_BLOCK;
 
-  lseek(fid,blk*IO_BLOCK,SEEK_SET);
+      lseek(fid,blk*IO_BLOCK,SEEK_SET);
+    }
 
   if (fastq)
     state = UK;
@@ -439,18 +893,26 @@ static void fast_nearest(Thread_Arg *data)
   fprintf(stderr,"\nFrom block %lld / offset %lld\n",blk,off);
 #endif
 
-  while (blk < inp->zsize)
-    {
+  while (1)
+    { if (bgzf)
+        { dat  = bam->bam;
+          slen = bam->ssize;
+        }
+      else
+        { if (blk >= inp->zsize)
+            break;
 #ifdef DEBUG_FIND
-      fprintf(stderr,"  Loading block %lld: @%lld",blk,lseek(fid,0,SEEK_CUR));
+          fprintf(stderr,"  Loading block %lld: @%lld",blk,lseek(fid,0,SEEK_CUR));
 #endif
-      slen = read(fid,buf,IO_BLOCK);
+          slen = read(fid,buf,IO_BLOCK);
+          dat  = buf;
 #ifdef DEBUG_FIND
-      fprintf(stderr," %d %d\n",slen,errno);
+          fprintf(stderr," %d %d\n",slen,errno);
 #endif
+        }
 
       for (b = off; b < slen; b++)
-        { c = buf[b];
+        { c = dat[b];
 #ifdef DEBUG_AUTO
           fprintf(stderr,"  %.5s: %c\n",Name[state],c);
 #endif
@@ -458,10 +920,7 @@ static void fast_nearest(Thread_Arg *data)
 
           { case UK:
               if (c == '@' && alive)
-                { data->beg.fpos = blk*IO_BLOCK + b;
-                  data->beg.boff = 0;
-                  return;
-                }
+                goto found;
               alive = (c == '\n' && ! (nl_2 || pl_1));
               nl_2 = nl_1;
               nl_1 = (c == '\n');
@@ -478,23 +937,35 @@ static void fast_nearest(Thread_Arg *data)
 
             case FK1:
               if (c == '>')
-                { data->beg.fpos = blk*IO_BLOCK + b;
-                  data->beg.boff = 0;
-                  return;
-                }
+                goto found;
               else if (c != '\n')
                 state = FK;
               break;
            }
         }
 
-      blk += 1;
+      if (bgzf)
+        { if ( ! bgzf_next(bam))
+            break;
+        }
+      else
+        blk += 1;
       off = 0;
     }
 
   data->beg.fpos = -1;
   data->beg.boff = 0;
   return;
+
+found:
+  if (bgzf)
+    { data->beg.fpos = bam->loc.fpos;
+      data->beg.boff = b;
+    }
+  else
+    { data->beg.fpos = blk*IO_BLOCK + b;
+      data->beg.boff = 0;
+    }
 }
 
 
@@ -583,9 +1054,11 @@ static void *fast_output_thread(void *arg)
   File_Object *inp;
   int          f, fid;
   gzFile       gzid = NULL;
+  BAM_FILE     _bam, *bam = &_bam;
   int64        blk, off;
   int64        epos, eblk, eoff;
-  int64        totread;
+  uint32       eboff;
+  int64        totread, zread;
   double       ratio;
 
   int   state, lastc;
@@ -612,6 +1085,7 @@ static void *fast_output_thread(void *arg)
   line = dset->bases;
 
   totread = 0;
+  zread   = 0;
   olen = 0;
   ratio = 1.;
 
@@ -619,11 +1093,17 @@ static void *fast_output_thread(void *arg)
     { inp = fobj+f;
       fid = open(inp->path,O_RDONLY);
       if (f < parm->eidx)
-        epos = inp->fsize;
+        { epos  = inp->fsize;
+          eboff = 0;
+        }
       else
-        epos = parm->end.fpos;
+        { epos  = parm->end.fpos;
+          eboff = parm->end.boff;
+        }
       if (f > parm->bidx)
-        parm->beg.fpos = 0;
+        { parm->beg.fpos = 0;
+          parm->beg.boff = 0;
+        }
 
 #ifdef DEBUG_IO
       fprintf(stderr,"Block: %12lld to %12lld --> %8lld\n",
@@ -636,7 +1116,11 @@ static void *fast_output_thread(void *arg)
       eblk  = (epos-1) / IO_BLOCK;
       eoff  = (epos-1) % IO_BLOCK + 1;
 
-      if (inp->zipd)
+      if (inp->bgzf)
+        { bam->decomp = parm->decomp;
+          bam_start(bam,fid,buf,&(parm->beg));
+        }
+      else if (inp->zipd)
         { gzid = gzdopen(fid,"r");
           eblk = 0x7fffffffffffffffll;
         }
@@ -650,33 +1134,54 @@ static void *fast_output_thread(void *arg)
       fprintf(stderr,"\nFrom block %lld / offset %lld\n",blk,off);
 #endif
 
-      while (blk <= eblk)
-        { int c, b, slen;
+      while (1)
+        { int    c, b, slen;
+          uint8 *dat;
+
+          if (inp->bgzf)                  //  Next BGZF block up to the end location
+            { if (bam->loc.fpos > epos)
+                break;
+              dat  = bam->bam;
+              slen = bam->ssize;
+              off  = bam->loc.boff;
+              if (bam->loc.fpos == epos && eboff < (uint32) slen)
+                slen = eboff;
+              totread += slen;
+              if (action == SAMPLE)
+                { zread += bam->bsize;
+                  ratio  = (1.*totread) / zread;
+                }
+            }
 
+          else
+            { if (blk > eblk)
+                break;
 #ifdef DEBUG_IO
-          fprintf(stderr,"  Loading block %lld: @%lld",blk,lseek(fid,0,SEEK_CUR));
+              fprintf(stderr,"  Loading block %lld: @%lld",blk,lseek(fid,0,SEEK_CUR));
 #endif
-          if (inp->zipd)
-            { slen = gzread(gzid,buf,IO_BLOCK);
-              if (blk == 0 && slen != 0 && action == SAMPLE)
-                ratio = (1.*slen) / gzoffset(gzid);
-            }
-          else
-            slen = read(fid,buf,IO_BLOCK);
+              if (inp->zipd)
+                { slen = gzread(gzid,buf,IO_BLOCK);
+                  if (blk == 0 && slen != 0 && action == SAMPLE)
+                    ratio = (1.*slen) / gzoffset(gzid);
+                }
+              else
+                slen = read(fid,buf,IO_BLOCK);
 
-          if (slen == 0)
-            break;
+              if (slen == 0)
+                break;
 
-          totread += slen;
+              totread += slen;
 #ifdef DEBUG_IO
-          fprintf(stderr," %d\n",slen);
+              fprintf(stderr," %d\n",slen);
 #endif
 
-          if (blk == eblk && eoff < slen)
-            slen = eoff;
+              if (blk == eblk && eoff < slen)
+                slen = eoff;
+              dat = buf;
+            }
 
           for (b = off; b < slen; b++)
-            { c = buf[b];
+            { c = dat[b];
 #ifdef DEBUG_AUTO
               fprintf(stderr,"  %.5s: %c\n",Name2[state],c);
 #endif
@@ -732,13 +1237,20 @@ static void *fast_output_thread(void *arg)
                     ADD(c)
               }
             }
-          blk += 1;
-          off = 0;
+
+          if (inp->bgzf)
+            { if (bam->loc.fpos >= epos || ! bgzf_next(bam))
+                break;
+            }
+          else
+            { blk += 1;
+              off = 0;
+            }
         }
       if (state == AEOL)
         END_SEQ(0)
 
-      if (inp->zipd)
+      if (inp->zipd && ! inp->bgzf)
         gzclose_r(gzid);
       else
         close(fid);
@@ -765,7 +1277,6 @@ static void *fast_output_thread(void *arg)
  *
  ********************************************************************************************/
 
-#define BAM_BLOCK  0x10000
 #define HEADER_LEN      36
 #define SEQ_RUN         40
 
@@ -788,18 +1299,6 @@ static int DNA[256] =
     0, 1, 1, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1,
   };
 
- //  Get value of little endian integer of n-bytes
-
-static inline uint32 getint(uint8 *buf, int n)
-{ uint32 val;
-  int    k;
-
-  val = 0;
-  for (k = n-1; k >= 0; k--)
-    val = (val << 8) | buf[k];
-  return (val);
-}
-
  //  Next len chars are printable and last is zero?
 
 static inline int valid_name(char *name, int len)
@@ -831,132 +1330,6 @@ static inline int valid_cigar(int32 *cigar, int len, int range)
 }
 
 
-/*******************************************************************************************
- *
- *  Routines to manage a BAM_FILE stream object
- *
- ********************************************************************************************/
-
-  //   Open BAM stream where compressed block start is known.  Compressed BAM blocks are buffered
-  //     in a very big IO buffer and the current uncompressed block is in a 64Kbp array.
-
-typedef struct
-  { int       fid;              //  file descriptor
-    int       last;             //  last block of data in file has been read
-    uint8    *buf;              //  IO buffer (of IO_BLOCK bytes, supplied by caller)
-    int       blen;             //  # of bytes currently in IO buffer
-    int       bptr;             //  start of next BAM block in IO buffer
-    uint8     bam[BAM_BLOCK+1]; //  uncompressed bam block
-    uint32    bsize;            //  length of compressed bam block
-    uint32    ssize;            //  length of uncompressed bam block
-    Location  loc;              //  current location in bam file
-    DEPRESS  *decomp;
-  } BAM_FILE;
-
-  //  Load next len bytes of uncompressed BAM data into array data
-
-static void bam_get(BAM_FILE *file, uint8 *data, int len)
-{ int    chk, off;
-  uint8 *bam  = file->bam;
-  int    boff = file->loc.boff;
-
-  off = 0;
-  chk = file->ssize - boff;
-  while (len >= chk)
-    { int    bptr, blen, bsize;
-      uint8 *block, *buf;
-      uint32 ssize;
-      size_t tsize;
-
-#ifdef DEBUG_BAM_IO
-      printf("Move %d bytes to data+%d from bam+%d\n",chk,off,boff);
-#endif
-      if (data != NULL)
-        memcpy(data+off,bam+boff,chk);
-      off += chk;
-      len -= chk;
-
-      file->loc.fpos += file->bsize;
-#ifdef DEBUG_BAM_IO
-      printf("File pos %lld\n",file->fpos);
-#endif
-
-      if (chk == 0 && len == 0)
-        { file->loc.boff = 0;
-          return;
-        }
-
-      buf   = file->buf;
-      bptr  = file->bptr;
-      blen  = file->blen;
-      block = buf+bptr;
-#ifdef DEBUG_BAM_IO
-      printf("Block at buffer %d\n",bptr);
-#endif
-      while (bptr + 18 > blen || bptr + (bsize = getint(block+16,2) + 1) > blen)
-        { chk = blen-bptr;
-          if (file->last)
-            { fprintf(stderr,"\n%s: Corrupted BAM file\n",Prog_Name);
-              Clean_Exit(1);
-            }
-          memmove(buf,block,chk);
-          blen = chk + read(file->fid,buf+chk,IO_BLOCK-chk);
-#ifdef DEBUG_BAM_IO
-          printf("Loaded %d to buf+%d for a total of %d\n",IO_BLOCK-chk,chk,blen);
-#endif
-          if (blen < IO_BLOCK)
-            file->last = 1;
-          file->blen = blen;
-          bptr = 0;
-          block = buf;
-        }
-
-      //  Fetch and uncompress next Bam block
-
-      if (libdeflate_gzip_decompress(file->decomp,block,bsize,bam,BAM_BLOCK,&tsize) != 0)
-        { fprintf(stderr,"\n%s: Bad gzip block\n",Prog_Name);
-          Clean_Exit(1);
-        }
-      ssize = tsize;
-      boff = 0;
-#ifdef DEBUG_BAM_IO
-      printf("Loaded gzip block of size %d into %d\n",bsize,ssize);
-#endif
-
-      file->bsize = bsize;
-      file->ssize = ssize;
-      file->bptr  = bptr + bsize;
-      chk = ssize;
-    }
-
-#ifdef DEBUG_BAM_IO
-  printf("Xfer %d bytes to data+%d from bam+%d\n",len,off,boff);
-#endif
-  if (data != NULL)
-    memcpy(data+off,bam+boff,len);
-  file->loc.boff = boff+len;
-}
-
-  //  Startup a bam stream, the location must be valid.
-
-static void bam_start(BAM_FILE *file, int fid, uint8 *buf, Location *loc)
-{ file->fid   = fid;
-  file->ssize = 0;
-  file->bsize = 0;
-  file->buf   = buf;
-  file->bptr  = 0;
-  file->blen  = 0;
-  file->last  = 0;
-  lseek(fid,loc->fpos,SEEK_SET);
-  file->loc.fpos = loc->fpos;
-  file->loc.boff = 0;
-  bam_get(file,NULL,loc->boff);
-}
-
-static int bam_eof(BAM_FILE *file)
-{ return (file->loc.boff == file->ssize && file->bptr == file->blen && file->last); }
-
-
 /*******************************************************************************************
  *
  *  Routines to manage a SAM stream, but as a BAM_FILE (only select fields are used)
@@ -1077,143 +1450,21 @@ static void skip_bam_header(Thread_Arg *parm)
   //    Return value is in parm->beg
 
 static void bam_nearest(Thread_Arg *parm)
-{ uint8       *buf  = parm->buf;
-  int          fid  = parm->fid;
-  DEPRESS     *decomp = parm->decomp;
-  int64        fpos = parm->beg.fpos;
+{ int          fid  = parm->fid;
 
   BAM_FILE  _bam, *bam = &_bam;
 
-  uint32 bptr, blen;
-  int    last, notfound;
-
   uint8 *block;
-  uint32 bsize, ssize;
-  size_t tsize;
-
-#ifdef DEBUG_FIND
-  fprintf(stderr,"Searching from %lld\n",fpos);
-  fflush(stderr);
-#endif
-
-  lseek(fid,fpos,SEEK_SET);
-  blen = 0;
-  bptr = 0;
-  last = 0;
-
-  //  Search until find a gzip block header
-
-  notfound = 1;
-  while (notfound)
-    { int    j;
-      uint32 isize, crc;
-
-      fpos += bptr;      //   Get more data at level of IO blocks
-      if (last)
-        { fprintf(stderr,"\n%s: Could not find bam block structure!\n",Prog_Name);
-          Clean_Exit(1);
-        }
-      else
-        { uint32 x = blen-bptr;
-          memmove(buf,buf+bptr,x);
-          blen = x + read(fid,buf+x,IO_BLOCK-x);
-          if (blen < IO_BLOCK)
-            last = 1;
-#ifdef DEBUG_FIND
-          fprintf(stderr,"Loading %d(last=%d)\n",blen,last);
-          fflush(stderr);
-#endif
-          bptr = 0;
-        }
-
-      while (bptr < blen)          //  Search IO block for Gzip block start
-        { if (buf[bptr++] != 31)
-            continue;
-          if ( buf[bptr] != 139)
-            continue;
-          bptr += 1;
-          if ( buf[bptr] != 8)
-            continue;
-          bptr += 1;
-          if ( buf[bptr] != 4)
-            continue;
-  
-#ifdef DEBUG_FIND
-          fprintf(stderr,"  Putative header @ %d\n",bptr-3);
-          fflush(stderr);
-#endif
-
-          if (bptr + 12 > blen)
-            { if (last)
-                continue;
-              bptr -= 3;
-              break;
-            }
-  
-          j = bptr+9;
-          if (buf[j] != 66)
-		  continue;
-          j += 1;
-          if (buf[j] != 67)
-            continue;
-          j += 1;
-          if (buf[j] != 2)
-            continue;
-          j += 1;
-          if (buf[j] != 0)
-            continue;
-          j += 1;
-    
-          bsize = getint(buf+j,2)+1;
-          block = buf+(bptr-3);
-
-          if ((bptr-3) + bsize > blen)
-            { if (last)
-                continue;
-              bptr -= 3;
-              break;
-            }
-
-#ifdef DEBUG_FIND
-          fprintf(stderr,"    Putative Extra %d\n",bsize);
-          fflush(stderr);
-#endif
-  
-          isize = getint(block+(bsize-4),4);
-          crc   = getint(block+(bsize-8),4);
-  
-          if (libdeflate_gzip_decompress(decomp,block,bsize,bam->bam,BAM_BLOCK,&tsize) != 0)
-            continue;
-          ssize = tsize;
-
-          if (ssize == isize && crc == libdeflate_crc32(0,bam->bam,ssize))
-            { bptr -= 3;
-              fpos  += bptr;
-              notfound = 0;
+  uint32 ssize;
 
-#ifdef DEBUG_FIND
-              fprintf(stderr,"    First block at %lld (%d)\n",fpos,ssize);
-              fflush(stderr);
-#endif
-	      break;
-            }
-        }
+  if ( ! bgzf_find_block(parm,bam))
+    { fprintf(stderr,"\n%s: Could not find bam block structure!\n",Prog_Name);
+      Clean_Exit(1);
     }
 
   //  Have found a gzip/bam block start, now scan blocks until can identify the start
   //    of a sequence entry
 
-  bam->fid      = fid;      //  Kick-start BAM stream object
-  bam->last     = last;
-  bam->buf      = buf;
-  bam->blen     = blen;
-  bam->bptr     = bptr+bsize;
-  bam->bsize    = bsize;
-  bam->ssize    = ssize;
-  bam->loc.fpos = fpos;
-  bam->loc.boff = 0;
-  bam->decomp   = decomp;
-
   while ( ! bam_eof(bam))
     { int    j, k;
       int    run, out, del;
@@ -2292,12 +2543,12 @@ Input_Partition *Partition_Input(int argc, char *argv[])
 
   nfiles = argc-1;
 
-  parm = (Thread_Arg *) Malloc(sizeof(Thread_Arg)*NTHREADS,"Allocating input threads");
+  parm = (Thread_Arg *) Malloc(sizeof(Thread_Arg)*IO_THREADS,"Allocating input threads");
   fobj = (File_Object *) Malloc (sizeof(File_Object)*nfiles,"Allocating file records"); 
   if (parm == NULL || fobj == NULL)
     Clean_Exit(1);
 
-  //  Find partition points dividing data in all files into NTHREADS roughly equal parts
+  //  Find partition points dividing data in all files into IO_THREADS roughly equal parts
   //    and then in parallel threads produce the output for each part.
 
   { int    f, i, t;
@@ -2317,7 +2568,7 @@ Input_Partition *Partition_Input(int argc, char *argv[])
     scan_header   = do_nothing;
     find_nearest  = fast_nearest;
 
-    gz_ok = (nfiles >= 3 || nfiles >= NTHREADS/2);
+    gz_ok = (nfiles >= 3 || nfiles >= IO_THREADS/2);
     work = 0;
     for (f = 0; f < nfiles; f++)
       { Fetch_File(argv[f+1],fobj+f,gz_ok);
@@ -2325,8 +2576,7 @@ Input_Partition *Partition_Input(int argc, char *argv[])
         if (f > 0)
           { if (fobj[f].ftype != ftype)
               { fprintf(stderr,"\n%s: All files must be of the same type\n",Prog_Name);
-                if (gz_ok)
-                  Free_Gunzips(fobj,f);
+                Free_Gunzips(fobj,f+1);
                 Clean_Exit(1);
               }
           }
@@ -2360,22 +2610,26 @@ Input_Partition *Partition_Input(int argc, char *argv[])
           }
         if ( ! (ftype == CRAM || ftype == DAZZ))
           need_buf = 1;
-        if (ftype == BAM)
+        if (ftype == BAM || fobj[f].bgzf)
           need_decon = 1;
-        if (fobj[f].zipd)
+        if (fobj[f].zipd && ! fobj[f].bgzf)
           file_split = 1;
 
         work += fobj[f].fsize;
       }
     parm[0].work = work;
 
-    //  If gzip'd files then divide whole files
+    //  If gzip'd files then divide whole files (BGZF files can be split like uncompressed
+    //    ones, but are then read as ordinary gzip files)
 
     if (file_split)
-      { if (nfiles <= 1.5*NTHREADS)
+      { for (f = 0; f < nfiles; f++)
+          fobj[f].bgzf = 0;
+
+        if (nfiles <= 1.5*IO_THREADS)
           ITHREADS = nfiles;
         else
-          ITHREADS = NTHREADS;
+          ITHREADS = IO_THREADS;
 
         if (VERBOSE)
           { fprintf(stderr,"\nUsing %d threads to read %d %s files some or all",
@@ -2389,8 +2643,7 @@ Input_Partition *Partition_Input(int argc, char *argv[])
         if (need_buf)
           { bf = Malloc(ITHREADS*IO_BLOCK,"Allocating IO_Buffer\n");
             if (bf == NULL)
-              { if (gz_ok)
-                  Free_Gunzips(fobj,nfiles);
+              { Free_Gunzips(fobj,nfiles);
                 Clean_Exit(1);
               }
           }
@@ -2422,21 +2675,20 @@ Input_Partition *Partition_Input(int argc, char *argv[])
     //    point for each thread.  Also find the beginning of data in
     //    each file that a thread will start in (place in end.fpos)
 
-    if (work/NTHREADS < .02*IO_BLOCK)
+    if (work/IO_THREADS < .02*IO_BLOCK)
       { ITHREADS = work/(.02*IO_BLOCK);
         if (ITHREADS <= 0)
           ITHREADS = 1;
       }
     else
-      ITHREADS = NTHREADS;
+      ITHREADS = IO_THREADS;
 
     //  Allocate IO buffer space
 
     if (need_buf)
       { bf = Malloc(ITHREADS*IO_BLOCK,"Allocating IO_Buffer\n");
         if (bf == NULL)
-          { if (gz_ok)
-              Free_Gunzips(fobj,nfiles);
+          { Free_Gunzips(fobj,nfiles);
             Clean_Exit(1);
           }
       }
@@ -2446,10 +2698,10 @@ Input_Partition *Partition_Input(int argc, char *argv[])
     if (VERBOSE)
       { if (nfiles > 1)
           fprintf(stderr,"\nPartitioning %d %s.%s files into %d parts\n",
-                         nfiles,fobj->zipd?"compressed ":"",Tstring[fobj->ftype],NTHREADS);
+                         nfiles,fobj->zipd?"compressed ":"",Tstring[fobj->ftype],IO_THREADS);
         else
           fprintf(stderr,"\nPartitioning %d %s.%s file into %d parts\n",
-                         nfiles,fobj->zipd?"compressed ":"",Tstring[fobj->ftype],NTHREADS);
+                         nfiles,fobj->zipd?"compressed ":"",Tstring[fobj->ftype],IO_THREADS);
         fflush(stderr);
       }
 
@@ -2526,8 +2778,7 @@ Input_Partition *Partition_Input(int argc, char *argv[])
       { if (need_buf)
           { bf = Realloc(bf,t*IO_BLOCK,"Allocating IO_Buffer\n");
             if (bf == NULL)
-              { if (gz_ok)
-                  Free_Gunzips(fobj,nfiles);
+              { Free_Gunzips(fobj,nfiles);
                 Clean_Exit(1);
               }
             for (i = 0; i < t; i++)
@@ -2539,8 +2790,8 @@ Input_Partition *Partition_Input(int argc, char *argv[])
 
     //  If cannot use all threads report it
 
-    if (VERBOSE && NTHREADS != ITHREADS)
-      { if (work/NTHREADS < .02*IO_BLOCK)
+    if (VERBOSE && IO_THREADS != ITHREADS)
+      { if (work/IO_THREADS < .02*IO_BLOCK)
           fprintf(stderr,"  File%s so small will use only %d thread%s\n",
                          nfiles>1?"s are":" is",ITHREADS,ITHREADS>1?"s ":" ");
         else
@@ -2703,18 +2954,14 @@ void Scan_All_Input(Input_Partition *parts)
 
 void Free_Input_Partition(Input_Partition *parts)
 { Thread_Arg *parm = (Thread_Arg *) parts;
-  int nfiles, gz_ok;
   int i, f;
 
-  nfiles = parm[ITHREADS-1].eidx + 1;
-  gz_ok = (nfiles >= 3 || nfiles >= NTHREADS/2);
-
   if (parm[0].decomp != NULL)
     for (i = 0; i < ITHREADS; i++)
       libdeflate_free_decompressor(parm[i].decomp);
   free(parm[0].buf);
   for (f = 0; f <= parm[ITHREADS-1].eidx; f++)
-    Free_File(parm[0].fobj+f,gz_ok);
+    Free_File(parm[0].fobj+f);
   free(parm[0].fobj);
   free(parm);
 }
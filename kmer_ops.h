@@ -0,0 +1,81 @@
+/*******************************************************************************************
+ *
+ *  Compare and copy kernels for the 2-bit packed k-mers (and their count entries) of FastK
+ *    and its utilities.  The byte strings compare lexicographically, so 8 bytes at a time
+ *    are compared as big-endian words (and 16 at a time with SSE2 when available), with a
+ *    byte loop for the remainder.  All are inline so that a call with a constant length
+ *    (e.g. KMER_BYTES = 6, 8, 10, or 13 for k = 21, 31, 40, or 51 when fixed) is unrolled
+ *    by the compiler.
+ *
+ *  Date  :  October 2026
+ *
+ *******************************************************************************************/
+
+#ifndef _KMER_OPS
+#define _KMER_OPS
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+  //  Return -1, 0, or 1 according to whether a[0..n-1] is less than, equal to, or greater
+  //    than b[0..n-1] in lexicographical order.
+
+static inline int mycmp(uint8_t *a, uint8_t *b, int n)
+{ uint64_t x, y;
+
+#ifdef __SSE2__
+  while (n >= 16)
+    { int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) a),
+                                               _mm_loadu_si128((__m128i *) b)));
+      if (m != 0xffff)
+        { m = __builtin_ctz(~m);
+          return (a[m] < b[m] ? -1 : 1);
+        }
+      a += 16;
+      b += 16;
+      n -= 16;
+    }
+#endif
+  while (n >= 8)
+    { memcpy(&x,a,8);
+      memcpy(&y,b,8);
+      if (x != y)
+        {
+#if __ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__
+          x = __builtin_bswap64(x);
+          y = __builtin_bswap64(y);
+#endif
+          return (x < y ? -1 : 1);
+        }
+      a += 8;
+      b += 8;
+      n -= 8;
+    }
+  while (n-- > 0)
+    { if (*a++ != *b++)
+        return (a[-1] < b[-1] ? -1 : 1);
+    }
+  return (0);
+}
+
+  //  Copy b[0..n-1] to a[0..n-1] where the two do not overlap
+
+static inline void mycpy(uint8_t *a, uint8_t *b, int n)
+{ uint64_t x;
+
+  while (n >= 8)
+    { memcpy(&x,b,8);
+      memcpy(a,&x,8);
+      a += 8;
+      b += 8;
+      n -= 8;
+    }
+  while (n-- > 0)
+    *a++ = *b++;
+}
+
+#endif // _KMER_OPS
@@ -7,7 +7,12 @@
  *
  *******************************************************************************************/
 
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "libfastk.h"
+#include "kmer_ops.h"
 
 #include "gene_core.c"
 
@@ -200,6 +205,14 @@ void Free_Histogram(Histogram *H)
 
 //  Private view of a Kmer_Table
 
+typedef struct
+  { int     nparts;       //  # of table parts
+    int64  *first;        //  first[p] = index of the 1st entry of part p (first[nparts] = nels)
+    uint8 **data;         //  entry i of part p is at data[p] + i*pbyte
+    uint8 **map;          //  mmap'd part file p and its length
+    int64  *mlen;
+  } Table_Map;
+
 typedef struct
   { int     kmer;         //  kmer length
     int     minval;       //  the minimum count of a k-mer in the table
@@ -215,10 +228,35 @@ typedef struct
     int64  *index;        //  prefix compression index
     int    *inver;        //  inverse prefix index
     int     shift;        //  shift for inverse mapping
+    Table_Map *map;       //  if not NULL then the parts are mapped in place and table is NULL
+    uint8  *model;        //  if not NULL then search radius (log2) of each prefix bucket
   } _Kmer_Table;
 
 #define TABLE(T) ((_Kmer_Table *) T)
 
+  //  Part of a mapped table containing entry i, and the address of entry i of any table
+
+static inline int kmer_part(Table_Map *M, int64 i)
+{ int l, r, m;
+
+  l = 0;
+  r = M->nparts-1;
+  while (l < r)
+    { m = ((l+r+1) >> 1);
+      if (M->first[m] <= i)
+        l = m;
+      else
+        r = m-1;
+    }
+  return (l);
+}
+
+static inline uint8 *kmer_entry(_Kmer_Table *T, int64 i)
+{ if (T->map == NULL)
+    return (T->table + i*T->pbyte);
+  return (T->map->data[kmer_part(T->map,i)] + i*T->pbyte);
+}
+
 /****************************************************************************************
  *
  *  Basic compressed sequence utilities
@@ -249,19 +287,6 @@ static void setup_fmer_table()
        }
 }
   
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? -1 : 1);
-    }
-  return (0);
-}
-
-static inline void mycpy(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    *a++ = *b++;
-}
-
 static int *inverse_index(int ixlen, int64 nels, int64 *index, int *pshift)
 { int64 step, pow;
   int   shift, inlen;
@@ -297,26 +322,6 @@ static int *inverse_index(int ixlen, int64 nels, int64 *index, int *pshift)
  *
  *****************************************************************************************/
 
-//  Reads over 2GB don't work on some systems, patch to overcome said
-
-static inline int64 big_read(int f, uint8 *buffer, int64 bytes)
-{ int64 v, x;
-
-  v = 0;
-  while (bytes > 0x70000000)
-    { x = read(f,buffer,0x70000000);
-      if (x < 0)
-        return (-1);
-      v += x;
-      bytes  -= 0x70000000;
-      buffer += 0x70000000;
-    }
-  x = read(f,buffer,bytes);
-  if (x < 0)
-    return (-1);
-  return (v+x);
-} 
-
 //  Load table encoded in file 'name' and create Kmer_Table object of entries
 //    with minimum count 'cut_off'
 
@@ -456,7 +461,7 @@ Kmer_Table *Load_Kmer_Table(char *name, int cut_off)
           f = open(full,O_RDONLY);
           read(f,&kmer,sizeof(int));
           read(f,&n,sizeof(int64));
-          big_read(f,table+nels*pbyte,n*pbyte);
+          Big_Read(f,table+nels*pbyte,n*pbyte);
           nels += n;
           close(f);
         }
@@ -481,14 +486,170 @@ Kmer_Table *Load_Kmer_Table(char *name, int cut_off)
   TABLE(T)->index = index;
   TABLE(T)->inver = inver;
   TABLE(T)->shift = shift;
+  TABLE(T)->map   = NULL;
+  TABLE(T)->model = NULL;
+
+  return (T);
+}
+
+//  Map the parts of the table encoded in file 'name' read-only and shared into memory in
+//    place, so that all the processes on a machine using a table share one copy of it in
+//    the page cache and there is nothing to load.  If 'populate' is set then the pages are
+//    read in now (and so are resident before any query), otherwise they are read on demand.
+
+Kmer_Table *Map_Kmer_Table(char *name, int populate)
+{ Kmer_Table  *T;
+  Table_Map   *M;
+  int          kmer, tbyte, kbyte, minval, ibyte, pbyte, hbyte;
+  int64        nels;
+  int64       *index, ixlen;
+  int         *inver, shift;
+
+  int    f, flen, flags;
+  char  *dir, *root, *full;
+  int    smer, nthreads;
+
+  setup_fmer_table();
+
+  //  Open stub file and get # of parts and the prefix index
+
+  dir  = PathTo(name);
+  root = Root(name,".ktab");
+  full = Malloc(strlen(dir)+strlen(root)+20,"Histogram name allocation");
+  if (full == NULL)
+    exit (1);
+  sprintf(full,"%s/%s.ktab",dir,root);
+  f = open(full,O_RDONLY);
+  sprintf(full,"%s/.%s.ktab.",dir,root);
+  flen = strlen(full);
+  free(root);
+  free(dir);
+  if (f < 0)
+    { free(full);
+      return (NULL);
+    }
+
+  read(f,&smer,sizeof(int));
+  read(f,&nthreads,sizeof(int));
+  read(f,&minval,sizeof(int));
+  read(f,&ibyte,sizeof(int));
+
+  kmer  = smer;
+  kbyte = (kmer+3)>>2;
+  tbyte = kbyte+2;
+  pbyte = tbyte-ibyte;
+  hbyte = kbyte-ibyte;
+  ixlen = (1 << (8*ibyte));
+
+  T     = Malloc(sizeof(Kmer_Table),"Allocating table record");
+  M     = Malloc(sizeof(Table_Map),"Allocating table record");
+  index = Malloc(ixlen*sizeof(int64),"Allocating table prefix index\n");
+  if (T == NULL || M == NULL || index == NULL)
+    exit (1);
+  M->nparts = nthreads;
+  M->first  = Malloc((nthreads+1)*sizeof(int64),"Allocating table part map");
+  M->mlen   = Malloc(nthreads*sizeof(int64),"Allocating table part map");
+  M->data   = Malloc(2*nthreads*sizeof(uint8 *),"Allocating table part map");
+  if (M->first == NULL || M->mlen == NULL || M->data == NULL)
+    exit (1);
+  M->map = M->data + nthreads;
+
+  read(f,index,ixlen*sizeof(int64));
+  close(f);
+
+  //  Map each part, the entries of which start after its k-mer length and entry count
+
+  flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (populate)
+    flags |= MAP_POPULATE;
+#endif
+
+  { int         p;
+    int64       n;
+    struct stat sb;
+
+    nels = 0;
+    for (p = 0; p < nthreads; p++)
+      { sprintf(full+flen,"%d",p+1);
+        f = open(full,O_RDONLY);
+        if (f < 0)
+          { fprintf(stderr,"Table part %s is missing ?\n",full);
+            exit (1);
+          }
+        read(f,&kmer,sizeof(int));
+        read(f,&n,sizeof(int64));
+        if (kmer != smer)
+          { fprintf(stderr,"Table part %s does not have k-mer length matching stub ?\n",full);
+            exit (1);
+          }
+        if (fstat(f,&sb) < 0 || sb.st_size != (off_t) (sizeof(int)+sizeof(int64)+n*pbyte))
+          { fprintf(stderr,"Table part %s is not of the size its header implies ?\n",full);
+            exit (1);
+          }
+        M->mlen[p] = sb.st_size;
+        M->map[p]  = mmap(NULL,M->mlen[p],PROT_READ,flags,f,0);
+        if (M->map[p] == MAP_FAILED)
+          { fprintf(stderr,"Cannot map table part %s into memory\n",full);
+            exit (1);
+          }
+        close(f);
+
+        madvise(M->map[p],M->mlen[p],MADV_RANDOM);
+#ifndef MAP_POPULATE
+        if (populate)
+          madvise(M->map[p],M->mlen[p],MADV_WILLNEED);
+#endif
+
+        M->first[p] = nels;
+        M->data[p]  = M->map[p] + (sizeof(int)+sizeof(int64)) - nels*pbyte;
+        nels += n;
+      }
+    M->first[nthreads] = nels;
+  }
+
+  free(full);
+
+  inver = inverse_index(ixlen,nels,index,&shift);
+
+  //  Finalize table record
+
+  T->kmer   = kmer;
+  T->minval = minval;
+  T->nels   = nels;
+  TABLE(T)->tbyte = tbyte;
+  TABLE(T)->kbyte = kbyte;
+  TABLE(T)->ibyte = ibyte;
+  TABLE(T)->pbyte = pbyte;
+  TABLE(T)->hbyte = hbyte;
+  TABLE(T)->ixlen = ixlen;
+  TABLE(T)->table = NULL;
+  TABLE(T)->index = index;
+  TABLE(T)->inver = inver;
+  TABLE(T)->shift = shift;
+  TABLE(T)->map   = M;
+  TABLE(T)->model = NULL;
 
   return (T);
 }
 
-//  Free all memory for table
+//  Free all memory for table (unmapping its parts if it was mapped)
 
 void Free_Kmer_Table(Kmer_Table *T)
-{ free(TABLE(T)->table);
+{ Table_Map *M = TABLE(T)->map;
+  int        p;
+
+  if (M != NULL)
+    { for (p = 0; p < M->nparts; p++)
+        munmap(M->map[p],M->mlen[p]);
+      free(M->data);
+      free(M->mlen);
+      free(M->first);
+      free(M);
+    }
+  else
+    free(TABLE(T)->table);
+  free(TABLE(T)->model);
   free(TABLE(T)->index);
   free(TABLE(T)->inver);
   free(T);
@@ -547,7 +708,7 @@ char *Fetch_Kmer(Kmer_Table *_T, int64 i, char *seq)
         break;
     }
 
-    a = T->table + i*T->pbyte;
+    a = kmer_entry(T,i);
     for (j = 0; j < hbyte; j++, s += 4)
       memcpy(s,fmer[a[j]],4);
     seq[T->kmer] = '\0';
@@ -559,7 +720,7 @@ char *Fetch_Kmer(Kmer_Table *_T, int64 i, char *seq)
   //  Asssumes i is in range
 
 inline int Fetch_Count(Kmer_Table *T, int64 i)
-{ return (*((uint16 *) (TABLE(T)->table+i*TABLE(T)->pbyte+TABLE(T)->hbyte))); }
+{ return (*((uint16 *) (kmer_entry(TABLE(T),i)+TABLE(T)->hbyte))); }
 
 
 /****************************************************************************************
@@ -659,24 +820,85 @@ static void compress_comp(char *s, int len, uint8 *t)
   s3[0] = e;
 }
 
-int64 Find_Kmer(Kmer_Table *_T, char *kseq)
-{ _Kmer_Table *T = (_Kmer_Table *) _T;
-  int    kmer  = T->kmer;
-  int    ibyte = T->ibyte;
-  int    hbyte = T->hbyte;
-  int    pbyte = T->pbyte;
-  uint8 *table = T->table;
+  //  K-mers are close to uniformly distributed within a prefix bucket [l,t), so the index
+  //    of a k-mer whose suffix begins with the 64-bit word x is estimated as l + x(t-l)/2^64.
+  //    Model_Kmer_Table records for each bucket the number of bits e of the largest error
+  //    of this estimate over its entries, whereupon a search need only bisect the
+  //    2^(e+1)+1 entries about the estimate.  As the estimate is monotone in x, the place
+  //    of an absent k-mer is also in this window.  Without a model the whole bucket is
+  //    bisected.
+
+static inline uint64 suffix_word(uint8 *a, int hbyte)
+{ uint64 x;
+  int    j;
+
+  x = 0;
+  for (j = 0; j < 8; j++)
+    x = (x << 8) | (j < hbyte ? a[j] : 0);
+  return (x);
+}
+
+static inline int64 model_guess(uint64 x, int64 l, int64 t)
+{ int64 g = l + (int64) (((double) x) * ((double) (t-l)) * 0x1p-64);
+  return (g < t ? g : t-1);
+}
+
+void Model_Kmer_Table(Kmer_Table *_T)
+{ _Kmer_Table *T = TABLE(_T);
   int64 *index = T->index;
+  int    hbyte = T->hbyte;
+  uint8 *model;
+  int64  l, t, i, d, err;
+  int    m, e;
 
-  uint8  cmp[T->kbyte], *c;
-  int64  l, r, m, t;
+  if (T->model != NULL)
+    return;
+
+  model = Malloc(T->ixlen,"Allocating table search model");
+  if (model == NULL)
+    exit (1);
+
+  l = 0;
+  for (m = 0; m < T->ixlen; m++)
+    { t   = index[m];
+      err = 0;
+      for (i = l; i < t; i++)
+        { d = model_guess(suffix_word(kmer_entry(T,i),hbyte),l,t) - i;
+          if (d < 0)
+            d = -d;
+          if (d > err)
+            err = d;
+        }
+      for (e = 0; err > 0; e++)
+        err >>= 1;
+      model[m] = e;
+      l = t;
+    }
+
+  T->model = model;
+}
 
-  //  kseq must be at least kmer bp long
+  //  Compress kseq (at least kmer bp long) canonically into cmp
 
-  if (is_minimal(kseq,kmer))
-    compress_norm(kseq,kmer,cmp);
+static inline void kmer_compress(_Kmer_Table *T, char *kseq, uint8 *cmp)
+{ if (is_minimal(kseq,T->kmer))
+    compress_norm(kseq,T->kmer,cmp);
   else
-    compress_comp(kseq,kmer,cmp);
+    compress_comp(kseq,T->kmer,cmp);
+}
+
+  //  Set [*pl,*pt) to the range of the prefix bucket of compressed k-mer cmp, returning 0
+  //    if the bucket is empty.  The k-mer's place is to be sought in [*pl,*pr] (the bucket
+  //    unless there is a model).  *pbase is set to the base address of entries in the range,
+  //    or NULL if a mapped table has the range in more than one part (whereupon probe finds
+  //    each entry's part).
+
+static int kmer_bucket(_Kmer_Table *T, uint8 *cmp, int64 *pl, int64 *pr, int64 *pt,
+                       uint8 **pbase)
+{ int    ibyte = T->ibyte;
+  int64 *index = T->index;
+  uint8 *c;
+  int64  l, m;
 
   c = cmp;
   m = *c++;
@@ -686,28 +908,230 @@ int64 Find_Kmer(Kmer_Table *_T, char *kseq)
     l = 0;
   else
     l = index[m-1];
-  if (l >= T->nels)
-    return (-1);
-  r = t = index[m];
-  if (r <= l)
+  if (l >= T->nels || index[m] <= l)
+    return (0);
+  *pl = l;
+  *pt = index[m];
+  *pr = index[m];
+
+  //  If modeled, then narrow [*pl,*pr) to the window about the estimate
+
+  if (T->model != NULL)
+    { int64 g, w;
+
+      g = model_guess(suffix_word(c,T->hbyte),l,*pt);
+      w = (1ll << T->model[m]) - 1;
+      if (g-w > l)
+        *pl = g-w;
+      if (g+w+1 < *pr)
+        *pr = g+w+1;
+    }
+
+  //  If mapped, then [l,t) is almost always in a single part
+
+  *pbase = T->table;
+  if (T->map != NULL)
+    { int p = kmer_part(T->map,l);
+      if (*pt <= T->map->first[p+1])
+        *pbase = T->map->data[p];
+    }
+  return (1);
+}
+
+static inline uint8 *probe(_Kmer_Table *T, uint8 *base, int64 i)
+{ if (base != NULL)
+    return (base + i*T->pbyte);
+  return (kmer_entry(T,i));
+}
+
+int64 Find_Kmer(Kmer_Table *_T, char *kseq)
+{ _Kmer_Table *T = (_Kmer_Table *) _T;
+  int    hbyte = T->hbyte;
+
+  uint8  cmp[T->kbyte], *c, *base;
+  int64  l, r, m, t;
+
+  kmer_compress(T,kseq,cmp);
+  if ( ! kmer_bucket(T,cmp,&l,&r,&t,&base))
     return (-1);
+  c = cmp + T->ibyte;
 
   // smallest l s.t. KMER(l) >= (kmer) c  (or nels if does not exist)
 
   while (l < r)
     { m = ((l+r) >> 1);
-      if (mycmp(table+m*pbyte,c,hbyte) < 0)
+      if (mycmp(probe(T,base,m),c,hbyte) < 0)
         l = m+1;
       else
         r = m;
     }
 
-  if (l >= t || mycmp(table+l*pbyte,c,hbyte) != 0)
+  if (l >= t || mycmp(probe(T,base,l),c,hbyte) != 0)
     return (-1);
 
   return (l);
 }
 
+  //  Find each of the n <= FIND_BATCH compressed k-mers cmp[j*kbyte..] in the table, setting
+  //    idx[j] to its index or -1.  The binary searches are run in lockstep, each prefetching
+  //    its next probe, so that their cache misses overlap instead of following one another.
+  //    An idx[j] of -2 on entry marks a k-mer that is not to be searched for.
+
+#define FIND_BATCH 16
+
+static void find_batch(_Kmer_Table *T, int n, uint8 *cmp, int64 *idx)
+{ int    hbyte = T->hbyte;
+  int    kbyte = T->kbyte;
+
+  uint8 *base[FIND_BATCH];
+  int64  l[FIND_BATCH], r[FIND_BATCH], t[FIND_BATCH];
+  int    act[FIND_BATCH], na;
+  int    a, j;
+  int64  m;
+  uint8 *c;
+
+  na = 0;
+  for (j = 0; j < n; j++)
+    if (idx[j] == -2)
+      continue;
+    else if (kmer_bucket(T,cmp+j*kbyte,l+j,r+j,t+j,base+j))
+      { act[na++] = j;
+        __builtin_prefetch(probe(T,base[j],(l[j]+r[j]) >> 1));
+      }
+    else
+      idx[j] = -1;
+
+  while (na > 0)
+    for (a = 0; a < na; )
+      { j = act[a];
+        c = cmp + (j*kbyte + T->ibyte);
+        m = ((l[j]+r[j]) >> 1);
+        if (mycmp(probe(T,base[j],m),c,hbyte) < 0)
+          l[j] = m+1;
+        else
+          r[j] = m;
+        if (l[j] < r[j])
+          { __builtin_prefetch(probe(T,base[j],(l[j]+r[j]) >> 1));
+            a += 1;
+          }
+        else
+          { if (l[j] >= t[j] || mycmp(probe(T,base[j],l[j]),c,hbyte) != 0)
+              idx[j] = -1;
+            else
+              idx[j] = l[j];
+            act[a] = act[--na];
+          }
+      }
+}
+
+  //  Find each of the n k-mers kseq[i] in the table, setting idx[i] to its index or -1.
+
+void Find_Kmers(Kmer_Table *_T, int n, char **kseq, int64 *idx)
+{ _Kmer_Table *T = (_Kmer_Table *) _T;
+  int    kbyte = T->kbyte;
+
+  uint8  cmp[FIND_BATCH*kbyte];
+  int    b, e, j;
+
+  for (b = 0; b < n; b += FIND_BATCH)
+    { e = n-b;
+      if (e > FIND_BATCH)
+        e = FIND_BATCH;
+      for (j = 0; j < e; j++)
+        { kmer_compress(T,kseq[b+j],cmp+j*kbyte);
+          idx[b+j] = 0;
+        }
+      find_batch(T,e,cmp,idx+b);
+    }
+}
+
+  //  Place in out[i] the count of the (canonical) k-mer at position i of seq[0..len-1] for
+  //    i in [0,len-kmer], or 0 if it is not in the table, returning the number of k-mers.
+  //    The 2-bit encodings of the k-mer and of its complement are rolled along seq in
+  //    kmer-bit strings of 64-bit words, fwd left to right and rev right to left, whereupon
+  //    the canonical one is the lesser.  A k-mer equal to its predecessor (as in a
+  //    low-complexity run) takes its count without a search.
+
+int Fetch_Sequence_Counts(Kmer_Table *_T, char *seq, int len, uint16 *out)
+{ _Kmer_Table *T = (_Kmer_Table *) _T;
+  int    kmer  = T->kmer;
+  int    kbyte = T->kbyte;
+  int    hbyte = T->hbyte;
+  int    nw    = (kmer+31) >> 5;
+
+  uint64 fwd[nw+1], rev[nw], *w;
+  uint8  cmp[FIND_BATCH*kbyte], last[kbyte], *c;
+  int64  idx[FIND_BATCH];
+  int    i, j, n, b, e, x;
+  int    top, tsh, bot, bsh;
+
+  if (len < kmer)
+    return (0);
+  n = (len-kmer)+1;
+
+  top = (kmer-1) >> 5;             //  word and shift of the last base of a k-mer
+  tsh = 62 - 2*((kmer-1) & 0x1f);
+  bot = kmer >> 5;                 //  word and shift of the base just beyond a k-mer
+  bsh = 62 - 2*(kmer & 0x1f);
+
+  for (j = 0; j <= nw; j++)
+    fwd[j] = 0;
+  for (j = 0; j < nw; j++)
+    rev[j] = 0;
+
+  i = 0;
+  for (b = 0; b < n; b += FIND_BATCH)
+    { e = n-b;
+      if (e > FIND_BATCH)
+        e = FIND_BATCH;
+
+      for (j = 0; j < e; j++)
+        { for ( ; i < b+j+kmer; i++)
+            { x = (int) seq[i];
+              for (w = fwd; w < fwd+nw; w++)
+                w[0] = (w[0] << 2) | (w[1] >> 62);
+              fwd[top] |= ((uint64) code[x]) << tsh;
+              for (w = rev+(nw-1); w > rev; w--)
+                w[0] = (w[0] >> 2) | (w[-1] << 62);
+              rev[0] = (rev[0] >> 2) | (((uint64) comp[x]) << 62);
+              if (bot < nw)
+                rev[bot] &= ~(0x3ull << bsh);
+            }
+
+          w = fwd;
+          for (x = 0; x < nw; x++)
+            if (fwd[x] != rev[x])
+              { if (fwd[x] > rev[x])
+                  w = rev;
+                break;
+              }
+
+          c = cmp + j*kbyte;
+          for (x = 0; x < kbyte; x++)
+            c[x] = (uint8) (w[x >> 3] >> (56 - 8*(x & 0x7)));
+
+          if (b+j > 0 && mycmp(c,(j > 0 ? c-kbyte : last),kbyte) == 0)
+            idx[j] = -2;
+          else
+            idx[j] = 0;
+        }
+
+      find_batch(T,e,cmp,idx);
+
+      for (j = 0; j < e; j++)
+        if (idx[j] == -2)
+          out[b+j] = out[b+j-1];
+        else if (idx[j] < 0)
+          out[b+j] = 0;
+        else
+          out[b+j] = *((uint16 *) (kmer_entry(T,idx[j])+hbyte));
+
+      mycpy(last,cmp+(e-1)*kbyte,kbyte);
+    }
+
+  return (n);
+}
+
 /****************************************************************************************
  *
  *  K-MER STREAM CODE
@@ -742,11 +1166,21 @@ typedef struct
     uint8 *ctop;       //  Ptr top of current table block in buffer
     int64 *neps;       //  Size of each thread part in elements
     int    clone;      //  Is this a clone?
+                   //  Readahead
+    int64  smax;       //  Largest read in entries (0 => readahead off, always STREAM_BLOCK)
+    uint8 *back;       //  Buffer being filled in the background (swapped with table)
+    int64  tmax;       //  # of entries table can hold
+    int64  bmax;       //  # of entries back can hold
+    int64  blen;       //  # of entries to read next (0 => stream was just positioned)
+    int64  bread;      //  # of bytes read into back
+    int    ahead;      //  Is a read into back in progress?
+    pthread_t thread;  //  Thread doing the read
   } _Kmer_Stream;
 
 #define STREAM(S) ((_Kmer_Stream *) S)
 
-#define STREAM_BLOCK 1024
+#define STREAM_BLOCK 1024       //  Entries read after a stream is positioned (or always)
+#define STREAM_MAX   0x400000   //  Largest read in bytes allowed with readahead
 
 /****************************************************************************************
  *
@@ -754,18 +1188,83 @@ typedef struct
  *
  *****************************************************************************************/
 
-//  Load up the table buffer with the next STREAM_BLOCK suffixes (if possible)
+//  A stream reads STREAM_BLOCK entries at a time.  If readahead has been turned on with
+//    Readahead_Kmer_Stream, then once the stream is read sequentially the size of each read
+//    doubles up to the given maximum and the next block is read into a second buffer by a
+//    background thread while the current one is consumed.  Just after the stream is
+//    positioned it again reads STREAM_BLOCK entries, so that random access does not read
+//    much more than it uses.
+
+static void *stream_ahead(void *arg)
+{ _Kmer_Stream *S = (_Kmer_Stream *) arg;
+
+  S->bread = read(S->copn,S->back,S->blen*S->pbyte);
+  return (NULL);
+}
+
+  //  Wait for any read in progress and discard its data, moving the file back to the end of
+  //    the current block, as the stream is to be positioned (which may be where it is)
+
+static void stream_halt(_Kmer_Stream *S)
+{ if (S->ahead)
+    { pthread_join(S->thread,NULL);
+      S->ahead = 0;
+      if (S->bread > 0)
+        lseek(S->copn,-S->bread,SEEK_CUR);
+    }
+  S->blen = 0;
+}
+
+  //  Open part p of the table for sequential reading
+
+static int open_part(_Kmer_Stream *S, int p)
+{ int f;
+
+  sprintf(S->name+S->nlen,"%d",p);
+  f = open(S->name,O_RDONLY);
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (f >= 0)
+    posix_fadvise(f,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+  return (f);
+}
+
+//  Load up the table buffer with the next block of suffixes (if possible)
 
 static void More_Kmer_Stream(_Kmer_Stream *S)
 { int    pbyte = S->pbyte;
-  uint8 *table = S->table;
   int    copn  = S->copn;
-  uint8 *ctop;
+  uint8 *table, *ctop;
+  int64  n;
 
   if (S->part > S->nthr)
     return;
-  while (1)
-    { ctop = table + read(copn,table,STREAM_BLOCK*pbyte);
+
+  if (S->ahead)
+    { pthread_join(S->thread,NULL);
+      S->ahead = 0;
+
+      table   = S->back;
+      S->back = S->table;
+      S->table = table;
+      n       = S->bmax;
+      S->bmax = S->tmax;
+      S->tmax = n;
+
+      ctop = table + S->bread;
+    }
+  else
+    { table = S->table;
+      ctop  = table;
+    }
+
+  n = S->blen;
+  if (n == 0)
+    n = STREAM_BLOCK;
+  if (n > S->tmax)
+    n = S->tmax;
+  while (ctop <= table)
+    { ctop = table + read(copn,table,n*pbyte);
       if (ctop > table)
         break;
       close(copn);
@@ -774,13 +1273,32 @@ static void More_Kmer_Stream(_Kmer_Stream *S)
         { S->csuf = NULL;
           return;
         }
-      sprintf(S->name+S->nlen,"%d",S->part);
-      copn = open(S->name,O_RDONLY);
+      copn = open_part(S,S->part);
       lseek(copn,sizeof(int)+sizeof(int64),SEEK_SET);
     }
   S->csuf = table;
   S->ctop = ctop;
   S->copn = copn;
+
+  //  If reading sequentially, then start reading the next (larger) block in the background
+
+  if (S->blen == 0 || S->smax == 0)
+    S->blen = STREAM_BLOCK;
+  else
+    { if (2*S->blen <= S->smax)
+        S->blen *= 2;
+      if (S->bmax < S->blen)
+        { S->bmax = S->blen;
+          S->back = Realloc(S->back,S->bmax*pbyte,"Allocating k-mer buffer");
+          if (S->back == NULL)
+            exit (1);
+        }
+      S->ahead = 1;
+      if (pthread_create(&S->thread,NULL,stream_ahead,S) != 0)
+        { S->ahead = 0;
+          S->blen  = 0;
+        }
+    }
 }
 
 Kmer_Stream *Open_Kmer_Stream(char *name)
@@ -880,10 +1398,16 @@ Kmer_Stream *Open_Kmer_Stream(char *name)
   S->nthr   = nthreads;
   S->clone  = 0;
 
+  S->smax  = 0;
+  S->back  = NULL;
+  S->tmax  = STREAM_BLOCK;
+  S->bmax  = 0;
+  S->blen  = 0;
+  S->ahead = 0;
+
   //  Set position to beginning
 
-  sprintf(S->name+S->nlen,"%d",1);
-  copn = open(S->name,O_RDONLY);
+  copn = open_part(S,1);
   lseek(copn,sizeof(int)+sizeof(int64),SEEK_SET);
 
   S->copn  = copn;
@@ -924,10 +1448,15 @@ Kmer_Stream *Clone_Kmer_Stream(Kmer_Stream *O)
     exit (1);
   strncpy(S->name,STREAM(O)->name,S->nlen);
 
+  S->back  = NULL;
+  S->tmax  = STREAM_BLOCK;
+  S->bmax  = 0;
+  S->blen  = 0;
+  S->ahead = 0;
+
   //  Set position to beginning
 
-  sprintf(S->name+S->nlen,"%d",1);
-  copn = open(S->name,O_RDONLY);
+  copn = open_part(S,1);
   lseek(copn,sizeof(int)+sizeof(int64),SEEK_SET);
 
   S->copn  = copn;
@@ -953,6 +1482,7 @@ Kmer_Stream *Clone_Kmer_Stream(Kmer_Stream *O)
 void Free_Kmer_Stream(Kmer_Stream *_S)
 { _Kmer_Stream *S = STREAM(_S);
 
+  stream_halt(S);
   if (!S->clone)
     { free(S->neps);
       free(S->index);
@@ -960,11 +1490,27 @@ void Free_Kmer_Stream(Kmer_Stream *_S)
     }
   free(S->name);
   free(S->table);
+  free(S->back);
   if (S->copn >= 0)
     close(S->copn);
   free(S);
 }
 
+  //  Let reads of S grow to bytes (at most STREAM_MAX) with a background readahead as S is
+  //    read sequentially, or if bytes is 0 (or too small), only ever read STREAM_BLOCK
+  //    entries at a time.  A clone of S inherits the setting.
+
+void Readahead_Kmer_Stream(Kmer_Stream *_S, int64 bytes)
+{ _Kmer_Stream *S = STREAM(_S);
+
+  stream_halt(S);
+  if (bytes > STREAM_MAX)
+    bytes = STREAM_MAX;
+  S->smax = bytes / S->pbyte;
+  if (S->smax < STREAM_BLOCK)
+    S->smax = 0;
+}
+
 /****************************************************************************************
  *
  *  Free, Iterate, and Get Stream Entries
@@ -976,11 +1522,11 @@ inline void First_Kmer_Entry(Kmer_Stream *_S)
   int64 *index = S->index;
 
   if (S->cidx != 0)
-    { if (S->part != 1)
+    { stream_halt(S);
+      if (S->part != 1)
         { if (S->part <= S->nthr)
             close(S->copn);
-          sprintf(S->name+S->nlen,"%d",1);
-          S->copn = open(S->name,O_RDONLY);
+          S->copn = open_part(S,1);
           S->part = 1;
         }
 
@@ -1115,6 +1661,7 @@ inline void GoTo_Kmer_Index(Kmer_Stream *_S, int64 i)
   if (S->cidx == i)
     return;
 
+  stream_halt(S);
   S->cidx = i;
 
   p = S->inver[i>>S->shift];
@@ -1167,6 +1714,8 @@ int GoTo_Kmer_Entry(Kmer_Stream *_S, uint8 *entry)
   int    p, f;
   int64  l, r, m, lo, hi;
 
+  stream_halt(S);
+
   m = *entry++;
   for (l = 1; l < ibyte; l++)
     m = (m << 8) | *entry++;
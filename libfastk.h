@@ -48,16 +48,20 @@ typedef struct
     int     minval;       //  The minimum count of a k-mer in the table
     int64   nels;         //  # of unique, sorted k-mers in the table
 
-    void   *private[7];   //  Private fields
+    void   *private[9];   //  Private fields
   } Kmer_Table;
 
 Kmer_Table *Load_Kmer_Table(char *name, int cut_off);
+Kmer_Table *Map_Kmer_Table(char *name, int populate);
 void        Free_Kmer_Table(Kmer_Table *T);
+void        Model_Kmer_Table(Kmer_Table *T);
 
 char       *Fetch_Kmer(Kmer_Table *T, int64 i, char *seq);
 int         Fetch_Count(Kmer_Table *T, int64 i);
 
 int64       Find_Kmer(Kmer_Table *T, char *kseq);
+void        Find_Kmers(Kmer_Table *T, int n, char **kseq, int64 *idx);
+int         Fetch_Sequence_Counts(Kmer_Table *T, char *seq, int len, uint16 *out);
 
 
   //  K-MER STREAM
@@ -83,6 +87,7 @@ typedef struct
 Kmer_Stream *Open_Kmer_Stream(char *name);
 Kmer_Stream *Clone_Kmer_Stream(Kmer_Stream *S);
 void         Free_Kmer_Stream(Kmer_Stream *S);
+void         Readahead_Kmer_Stream(Kmer_Stream *S, int64 bytes);
 
 void         First_Kmer_Entry(Kmer_Stream *S);
 void         Next_Kmer_Entry(Kmer_Stream *S);
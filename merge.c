@@ -2,7 +2,7 @@
  *
  *  Phase 4 of FastK: Given NPARTS sorted super-mer profiles for ITHREADS in NPANELS
  *    parts per thread, merge the super-mer NPARTS x NPANELS files for each thread
- *    (in subdirectory SORT_PATH) into single compressed read-profile files (in
+ *    (in the -P subdirectories) into single compressed read-profile files (in
  *    subdirectory "path").
  *
  *  Author:  Gene Myers
@@ -57,7 +57,7 @@ static void reload(IO_block *in)
     memmove(in->block, in->ptr, del);
   in->ptr  = in->block;
   in->top  = in->block + del;
-  in->top += read(in->stream,in->top,BUFLEN_UINT8-del);
+  in->top += Read_All(in->stream,in->top,BUFLEN_UINT8-del);
 }
 
   //  Thread to merge files of super-mer profiles
@@ -71,7 +71,7 @@ typedef struct
   } Entry;
 
 typedef struct
-  { char     *root;    //  Path & prefix of each part file
+  { char     *root;    //  Prefix of each part file
     IO_block *io;      //  input & output buffers
     Entry    *chord;   //  super-mer profiles vector
     int       wch;     //  Number of this thread
@@ -97,7 +97,7 @@ static void *merge_profile_thread(void *arg)
   uint8 *dbuf;
   int64 *abuf, *aptr, *atop;
   int64  offset;
-  int    nreads;
+  int64  nreads;
   char  *fname;
   int64  panel, nanel;
   int    naval, wlast;
@@ -127,7 +127,7 @@ static void *merge_profile_thread(void *arg)
   printf("THREAD %d\n",data->wch);
 #endif
 
-  fname = Malloc(strlen(data->root) + 100,"File name buffer");
+  fname = Malloc(SORT_PLEN + strlen(data->root) + 100,"File name buffer");
   if (fname == NULL)
     Clean_Exit(1);
 
@@ -153,7 +153,7 @@ static void *merge_profile_thread(void *arg)
 
   //  Open invalid interval file
 
-  sprintf(fname,"%s.NS.T%d",data->root,data->wch);
+  sprintf(fname,"%s/%s.NS.T%d",SORT_PATH,data->root,data->wch);
   nfile = fopen(fname,"r");
   if (nfile == NULL)
     { fprintf(stderr,"\n%s: Cannot open external file %s in %s\n",
@@ -196,8 +196,11 @@ static void *merge_profile_thread(void *arg)
         { if (src->panel >= 0)
             { close(src->stream);
 #ifndef DEVELOPER
-              sprintf(fname,"%s.%d.P%d.%d",data->root,n,data->wch,src->panel);
-              unlink(fname);
+              if (CHECKPOINT == NULL)
+                { sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(n,data->wch),
+                                data->root,n,data->wch,src->panel);
+                  unlink(fname);
+                }
 #endif
 #ifdef DEBUG
               printf("Closing Panel %d:%d.%d\n",n,data->wch,src->panel);
@@ -212,11 +215,12 @@ static void *merge_profile_thread(void *arg)
           printf("Starting Panel %d:%d.%d\n",n,data->wch,src->panel);
           fflush(stdout);
 #endif
-          sprintf(fname,"%s.%d.P%d.%d",data->root,n,data->wch,src->panel);
+          sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(n,data->wch),
+                        data->root,n,data->wch,src->panel);
           f = open(fname,O_RDONLY);
           if (f == -1)
             { fprintf(stderr,"\n%s: Cannot open external file %s in %s\n",
-                             Prog_Name,fname,SORT_PATH);
+                             Prog_Name,fname,Sort_Path(n,data->wch));
               Clean_Exit(1);
             }
 
@@ -230,7 +234,7 @@ static void *merge_profile_thread(void *arg)
           nidx = NUM_RID[data->wch];
 #endif
           src->stream = f;
-          src->top    = sptr + read(f,sptr,BUFLEN_UINT8);
+          src->top    = sptr + Read_All(f,sptr,BUFLEN_UINT8);
         }
 
       //  If panels exhausted then part is exhausted (has no data)
@@ -326,8 +330,11 @@ static void *merge_profile_thread(void *arg)
                     partin += src->top - src->block;
                   close(src->stream);
 #ifndef DEVELOPER
-                  sprintf(fname,"%s.%d.P%d.%d",data->root,n,data->wch,src->panel);
-                  unlink(fname);
+                  if (CHECKPOINT == NULL)
+                    { sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(n,data->wch),
+                                    data->root,n,data->wch,src->panel);
+                      unlink(fname);
+                    }
 #endif
                   src->panel += 1;
                   if (src->panel >= NPANELS)
@@ -337,16 +344,17 @@ static void *merge_profile_thread(void *arg)
                   printf("Starting Panel %d:%d.%d\n",n,data->wch,src->panel);
                   fflush(stdout);
 #endif
-                  sprintf(fname,"%s.%d.P%d.%d",data->root,n,data->wch,src->panel);
+                  sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(n,data->wch),
+                                data->root,n,data->wch,src->panel);
                   f = open(fname,O_RDONLY);
                   if (f == -1)
                     { fprintf(stderr,"\n%s: A Cannot open external file %s in %s\n",
-                                     Prog_Name,fname,SORT_PATH);
+                                     Prog_Name,fname,Sort_Path(n,data->wch));
                       Clean_Exit(1);
                     }
                   sptr = src->block;
                   src->stream = f;
-                  src->top    = sptr + read(f,sptr,BUFLEN_UINT8);
+                  src->top    = sptr + Read_All(f,sptr,BUFLEN_UINT8);
                 }
 
               //  If all panels exhausted then thread is exhausted
@@ -406,7 +414,7 @@ static void *merge_profile_thread(void *arg)
             if (len == 0)
               { if (iridx+nbase != p)           //  read < KMER bp long
                   { if (aptr >= atop)
-                      { if (write(afile,abuf,BUFLEN_IBYTE) < 0)
+                      { if (Write_All(afile,abuf,BUFLEN_IBYTE) < 0)
                           { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
                                            Prog_Name,data->aname);
                             Clean_Exit(1);
@@ -416,7 +424,7 @@ static void *merge_profile_thread(void *arg)
                     *aptr++ = offset + (o-dbuf);
 #ifdef SHOW_RUN
                     if (wlast)
-                      printf("READ %d\n  %5d:: SHORT\n",nreads,n);
+                      printf("READ %lld\n  %5d:: SHORT\n",nreads,n);
                     else
                       printf("  %5d:: SHORT\n",n);
 #endif
@@ -427,7 +435,7 @@ static void *merge_profile_thread(void *arg)
                       { *o++ = 0;
                         lz = 0;
 #ifdef SHOW_RUN
-                        printf("READ %d\n  %5d:: N=%d {0} [%02x]",nreads,n,ileng,o[-1]);
+                        printf("READ %lld\n  %5d:: N=%d {0} [%02x]",nreads,n,ileng,o[-1]);
 #endif
                       }
                     else
@@ -502,7 +510,7 @@ static void *merge_profile_thread(void *arg)
                             lz = 0;
                           }
                         if (aptr >= atop)
-                          { if (write(afile,abuf,BUFLEN_IBYTE) < 0)
+                          { if (Write_All(afile,abuf,BUFLEN_IBYTE) < 0)
                               { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
                                                Prog_Name,data->aname);
                                 Clean_Exit(1);
@@ -542,7 +550,7 @@ static void *merge_profile_thread(void *arg)
               { if (d < 128)
                   { *o++ = d;
 #ifdef SHOW_RUN
-                    printf("READ %d\n  %5d:: %3d: {%hu} [%02x]",nreads,n,len,d,o[-1]);
+                    printf("READ %lld\n  %5d:: %3d: {%hu} [%02x]",nreads,n,len,d,o[-1]);
 #endif
                   }
                 else
@@ -554,7 +562,7 @@ static void *merge_profile_thread(void *arg)
                     *o++ = db[1];
 #endif
 #ifdef SHOW_RUN
-                    printf("READ %d\n  %5d:: %3d: {%hu} [%02x.%02x]",nreads,n,len,d,o[-2],o[-1]);
+                    printf("READ %lld\n  %5d:: %3d: {%hu} [%02x.%02x]",nreads,n,len,d,o[-2],o[-1]);
 #endif
                   }
                 lcont = d;
@@ -694,7 +702,7 @@ static void *merge_profile_thread(void *arg)
                     lz = 0;
                   }
                 if (aptr >= atop)
-                  { if (write(afile,abuf,BUFLEN_IBYTE) < 0)
+                  { if (Write_All(afile,abuf,BUFLEN_IBYTE) < 0)
                       { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
                                        Prog_Name,data->aname);
                         Clean_Exit(1);
@@ -735,7 +743,7 @@ static void *merge_profile_thread(void *arg)
   //  Flush the A-file buffer
 
   if (aptr > abuf)
-    if (write(afile,abuf,(aptr-abuf)*sizeof(int64)) < 0)
+    if (Write_All(afile,abuf,(aptr-abuf)*sizeof(int64)) < 0)
       { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
                        Prog_Name,data->aname);
          Clean_Exit(1);
@@ -746,8 +754,10 @@ static void *merge_profile_thread(void *arg)
   fclose(nfile);
 
 #ifndef DEVELOPER
-  sprintf(fname,"%s.NS.T%d",data->root,data->wch);
-  unlink(fname);
+  if (CHECKPOINT == NULL)
+    { sprintf(fname,"%s/%s.NS.T%d",SORT_PATH,data->root,data->wch);
+      unlink(fname);
+    }
 #endif
 
   free(fname);
@@ -777,7 +787,7 @@ void Merge_Profiles(char *dpwd, char *dbrt)
   //  Chek that input files are at sort path and determine the number of panels,
   //     threads, and partitions
 
-  fname = Malloc(3*(strlen(dpwd) + strlen(SORT_PATH) + strlen(dbrt)) + 100,"File name buffer");
+  fname = Malloc(3*(strlen(dpwd) + SORT_PLEN + strlen(dbrt)) + 100,"File name buffer");
   if (fname == NULL)
     Clean_Exit(1);
 
@@ -801,11 +811,11 @@ void Merge_Profiles(char *dpwd, char *dbrt)
       { int         f, i;
         struct stat info;
 
-        sprintf(fname,"%s/%s.0.P%d.0",SORT_PATH,dbrt,t);
+        sprintf(fname,"%s/%s.0.P%d.0",Sort_Path(0,t),dbrt,t);
         f = open(fname,O_RDONLY);
         if (f == -1)
           { fprintf(stderr,"%s: A Cannot find file %s.0.P%d.0 in directory %s\n",
-                           Prog_Name,dbrt,t,SORT_PATH);
+                           Prog_Name,dbrt,t,Sort_Path(0,t));
             Clean_Exit(1);
           }
   
@@ -827,7 +837,7 @@ void Merge_Profiles(char *dpwd, char *dbrt)
             totin = info.st_size;
   
             for (i = 1; i < NPANELS; i++)
-              { sprintf(fname,"%s/%s.0.P0.%d",SORT_PATH,dbrt,i);
+              { sprintf(fname,"%s/%s.0.P0.%d",Sort_Path(0,0),dbrt,i);
                 stat(fname,&info);
                 totin += info.st_size;
               }
@@ -836,9 +846,27 @@ void Merge_Profiles(char *dpwd, char *dbrt)
       }
   }
 
+  //  The memory is divided evenly over the buffers, but no buffer need be larger than the
+  //    largest profile part file
+
   BUFLEN_UINT8 = SORT_MEMORY/((NPARTS+1)*ITHREADS);
-  if (BUFLEN_UINT8 > 0x7fffffffll)
-    BUFLEN_UINT8 = 0x7ffffff8ll;
+
+  { struct stat info;
+    int64       lmax;
+    int         p, t, i;
+
+    lmax = 0;
+    for (p = 0; p < NPARTS; p++)
+      for (t = 0; t < ITHREADS; t++)
+        for (i = 0; i < NPANELS; i++)
+          { sprintf(fname,"%s/%s.%d.P%d.%d",Sort_Path(p,t),dbrt,p,t,i);
+            if (stat(fname,&info) == 0 && info.st_size > lmax)
+              lmax = info.st_size;
+          }
+    lmax = ((lmax+0xfffff) & ~0xfffffll) + 0x100000;
+    if (BUFLEN_UINT8 > lmax)
+      BUFLEN_UINT8 = lmax;
+  }
   if (BUFLEN_UINT8 < 2*MAX_SUPER)
     BUFLEN_UINT8 = 2*MAX_SUPER;
 
@@ -878,14 +906,8 @@ void Merge_Profiles(char *dpwd, char *dbrt)
 
   //  Open up A- and D-files, assign blocks for the inputs, and setup thread params 
 
-  { char *root;
-    char *aname, *dname;
+  { char *aname, *dname;
     int   t, n, p;
-    
-    root = Malloc(strlen(SORT_PATH) + strlen(dbrt) + 10,"File name buffer");
-    if (root == NULL)
-      Clean_Exit(1);
-    sprintf(root,"%s/%s",SORT_PATH,dbrt);
 
     p = 0;
     for (t = 0; t < ITHREADS; t++)
@@ -911,7 +933,7 @@ void Merge_Profiles(char *dpwd, char *dbrt)
         if (aname == NULL || dname == NULL)
           Clean_Exit(1);
         
-        parmk[t].root  = root;
+        parmk[t].root  = dbrt;
         parmk[t].wch   = t;
         parmk[t].afile = f;
         parmk[t].aname = aname;
@@ -992,7 +1014,6 @@ void Merge_Profiles(char *dpwd, char *dbrt)
 
     //  Release working data
 
-    free(root);
     free(_chord);
     free(chord);
     free(blocks);
@@ -18,9 +18,15 @@
 #include <math.h>
 #include <pthread.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "libfastk.h"
 #include "FastK.h"
 
+#include "LIBDEFLATE/libdeflate.h"
+
 #define  USE_MAPPING
 #undef   HISTOGRAM_TEST
 #undef   MAXIMUM_TEST
@@ -485,6 +491,57 @@ int HSORT(const void *l, const void *r)
 
 static char DNA[4] = { 'a', 'c', 'g', 't' };
 
+  //  Set the base translation vectors given the frequency rank assn[0..3] of a, c, g, and t
+
+static void set_translation(int *assn)
+{ int i;
+
+  for (i = 0; i < 256; i++)
+    Tran[i] = assn[0];
+  Tran['a'] = Tran['A'] = assn[0];
+  Tran['c'] = Tran['C'] = assn[1];
+  Tran['g'] = Tran['G'] = assn[2];
+  Tran['t'] = Tran['T'] = assn[3];
+
+  for (i = 0; i < 256; i++)
+    Dran[i] = 4;
+  Dran['a'] = Dran['A'] = 0;
+  Dran['c'] = Dran['C'] = 1;
+  Dran['g'] = Dran['G'] = 2;
+  Dran['t'] = Dran['T'] = 3;
+
+  for (i = 0; i < 256; i++)
+    Fran[i] = 4;
+  Fran['a'] = Fran['A'] = 3;
+  Fran['c'] = Fran['C'] = 2;
+  Fran['g'] = Fran['G'] = 1;
+  Fran['t'] = Fran['T'] = 0;
+}
+
+  //  Set the globals that depend on the padding pad (Tran must already be set)
+
+static void set_padding(int pad)
+{ uint64 ct;
+  int    i;
+
+  PAD      = pad;
+  PAD2     = 2*PAD;
+  PAD_LEN  = MIN_LEN + PAD;
+  PAD_TOT  = (((int64) MIN_TOT) << PAD2);
+  PAD_L1   = PAD_LEN - 1;
+  PAD_MSK  = PAD_TOT - 1; 
+
+  MAX_SUPER = KMER - PAD_L1;
+
+  ct = (Tran['t'] << (2*PAD_L1));
+  for (i = 0; i < 256; i++)
+    Cran[i] = ct;
+  Cran['a'] = Cran['A'] = ct;
+  Cran['c'] = Cran['C'] = (Tran['g'] << (2*PAD_L1));
+  Cran['g'] = Cran['G'] = (Tran['c'] << (2*PAD_L1));
+  Cran['t'] = Cran['T'] = (Tran['a'] << (2*PAD_L1));
+}
+
   //  Determine the base mapping, the core prefix trie, and the assignment of core prefixes
   //     to buckets (set up in globals PAD and Min_Map, et.c above)
 
@@ -567,12 +624,7 @@ int Determine_Scheme(DATA_BLOCK *block)
       assn[i] = i;
 #endif
 
-    for (i = 0; i < 256; i++)
-      Tran[i] = assn[0];
-    Tran['a'] = Tran['A'] = assn[0];
-    Tran['c'] = Tran['C'] = assn[1];
-    Tran['g'] = Tran['G'] = assn[2];
-    Tran['t'] = Tran['T'] = assn[3];
+    set_translation(assn);
 
 #if defined(DEBUG_SCHEME) || defined(HISTOGRAM_TEST)
     printf("   Most freq = %lld  gc = %d%%\n",
@@ -586,20 +638,6 @@ int Determine_Scheme(DATA_BLOCK *block)
 #endif
   }
 
-  for (i = 0; i < 256; i++)
-    Dran[i] = 4;
-  Dran['a'] = Dran['A'] = 0;
-  Dran['c'] = Dran['C'] = 1;
-  Dran['g'] = Dran['G'] = 2;
-  Dran['t'] = Dran['T'] = 3;
-
-  for (i = 0; i < 256; i++)
-    Fran[i] = 4;
-  Fran['a'] = Fran['A'] = 3;
-  Fran['c'] = Fran['C'] = 2;
-  Fran['g'] = Fran['G'] = 1;
-  Fran['t'] = Fran['T'] = 0;
-
   //  Iteratively determine the padding needed for each MIN_LEN-mer given the target # of pieces
 
   //  Initial prefix trie is the complete quartenary tree of height MIN_LEN
@@ -619,23 +657,7 @@ int Determine_Scheme(DATA_BLOCK *block)
 
       // Compute stats with current prefix trie
 
-      PAD2     = 2*PAD;
-      PAD_LEN  = MIN_LEN + PAD;
-      PAD_TOT  = (((int64) MIN_TOT) << PAD2);
-      PAD_L1   = PAD_LEN - 1;
-      PAD_MSK  = PAD_TOT - 1; 
-
-      MAX_SUPER = KMER - PAD_L1;
-
-      { uint64 ct = (Tran['t'] << (2*PAD_L1));
-
-        for (i = 0; i < 256; i++)
-          Cran[i] = ct;
-        Cran['a'] = Cran['A'] = ct;
-        Cran['c'] = Cran['C'] = (Tran['g'] << (2*PAD_L1));
-        Cran['g'] = Cran['G'] = (Tran['c'] << (2*PAD_L1));
-        Cran['t'] = Cran['T'] = (Tran['a'] << (2*PAD_L1));
-      }
+      set_padding(PAD);
 
       parmt[0].count = count;
       for (i = 1; i < NTHREADS; i++)
@@ -800,6 +822,149 @@ int Determine_Scheme(DATA_BLOCK *block)
   return (MAX_SUPER);
 }
 
+  //  Save the scheme just determined in file name.  It consists of MIN_LEN, the padding,
+  //    the # of parts, the # of core prefix trie states, the base mapping for a, c, g, and t,
+  //    and then the trie itself, all as ints.
+
+  //  The scheme is written to a temporary file that is then renamed, so that several shards
+  //    started at once can each save the same scheme without interfering.
+
+void Save_Scheme(char *name)
+{ FILE *f;
+  int   head[8];
+  char *temp;
+
+  temp = Malloc(strlen(name)+20,"Allocating scheme name");
+  if (temp == NULL)
+    Clean_Exit(1);
+  sprintf(temp,"%s.%d",name,getpid());
+
+  f = fopen(temp,"w");
+  if (f == NULL)
+    { fprintf(stderr,"\n%s: Cannot create scheme file %s\n",Prog_Name,name);
+      Clean_Exit(1);
+    }
+
+  head[0] = MIN_LEN;
+  head[1] = PAD;
+  head[2] = NPARTS;
+  head[3] = Min_States;
+  head[4] = Tran['a'];
+  head[5] = Tran['c'];
+  head[6] = Tran['g'];
+  head[7] = Tran['t'];
+  fwrite(head,sizeof(int),8,f);
+  fwrite(Min_Part,sizeof(int),Min_States,f);
+  if (fclose(f) != 0)
+    { fprintf(stderr,"\n%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,name);
+      unlink(temp);
+      Clean_Exit(1);
+    }
+  if (rename(temp,name) != 0)
+    { fprintf(stderr,"\n%s: Cannot create scheme file %s\n",Prog_Name,name);
+      unlink(temp);
+      Clean_Exit(1);
+    }
+  free(temp);
+
+  if (VERBOSE)
+    fprintf(stderr,"  Saved the scheme in %s\n",name);
+}
+
+  //  Set up the base mapping, core prefix trie, and bucket assignment from the scheme
+  //    previously saved in file name instead of determining them.  Sets NPARTS, and
+  //    returns the # of k-mers in the longest super-mer.
+
+int Load_Scheme(char *name)
+{ FILE *f;
+  int   head[8];
+  int   i, n;
+
+  f = fopen(name,"r");
+  if (f == NULL)
+    { fprintf(stderr,"\n%s: Cannot open scheme file %s\n",Prog_Name,name);
+      Clean_Exit(1);
+    }
+
+  if (fread(head,sizeof(int),8,f) != 8 || head[0] != MIN_LEN || head[1] < 0
+                                       || head[2] <= 0 || head[3] < MIN_TOT)
+    goto bad_scheme;
+  for (i = 4; i < 8; i++)
+    if (head[i] < 0 || head[i] > 3)
+      goto bad_scheme;
+
+  Min_States = head[3];
+  Min_Part   = (int *) Malloc(sizeof(int)*Min_States,"Allocating scheme");
+  if (Min_Part == NULL)
+    Clean_Exit(1);
+  if (fread(Min_Part,sizeof(int),Min_States,f) != (size_t) Min_States)
+    goto bad_scheme;
+  for (i = 0; i < Min_States; i++)
+    { n = Min_Part[i];
+      if (n >= head[2] || (n < 0 && 3-n >= Min_States))
+        goto bad_scheme;
+    }
+  fclose(f);
+
+  set_translation(head+4);
+  set_padding(head[1]);
+
+  if (KMER < PAD_LEN)
+    { fprintf(stderr,"\n%s: K-mer must be at least %d to use scheme %s\n",
+                     Prog_Name,PAD_LEN,name);
+      Clean_Exit(1);
+    }
+
+  if (head[2] < NPARTS)
+    fprintf(stderr,"  Warning: scheme has %d parts, each will need more than -M memory\n",
+                   head[2]);
+  NPARTS = head[2];
+
+  if (VERBOSE)
+    fprintf(stderr,"  Using %d-minimizers with %d core prefixes and %d parts from %s\n",
+                   PAD_LEN,Min_States,NPARTS,name);
+
+  return (MAX_SUPER);
+
+bad_scheme:
+  fprintf(stderr,"\n%s: %s is not a valid scheme file\n",Prog_Name,name);
+  Clean_Exit(1);
+  return (0);
+}
+
+  //  Restrict the scheme to shard i of n.  The parts are divided into n consecutive ranges of
+  //    nearly equal size.  Those of the i'th range are renumbered from 0 and all others are
+  //    mapped to NPARTS, the new # of parts, so that Distribute_Block drops their super-mers.
+
+void Shard_Scheme(int shard, int nshards)
+{ int i, b;
+  int beg, end;
+
+  if (NPARTS < nshards)
+    { fprintf(stderr,"\n%s: Scheme has only %d parts, cannot divide it into %d shards\n",
+                     Prog_Name,NPARTS,nshards);
+      Clean_Exit(1);
+    }
+
+  beg = ((shard-1)*NPARTS)/nshards;
+  end = (shard*NPARTS)/nshards;
+  for (i = 0; i < Min_States; i++)
+    { b = Min_Part[i];
+      if (b < 0)
+        continue;
+      if (beg <= b && b < end)
+        Min_Part[i] = b-beg;
+      else
+        Min_Part[i] = end-beg;
+    }
+
+  if (VERBOSE)
+    fprintf(stderr,"  Shard %d of %d counts parts %d to %d of %d\n",
+                   shard,nshards,beg+1,end,NPARTS);
+
+  NPARTS = end-beg;
+}
+
 
 /*******************************************************************************************
  *
@@ -859,130 +1024,41 @@ static inline IO_UTYPE *Stuff_Int(int64 n, int nbits, IO_UTYPE *buf, int *bitp)
   return (buf);
 }
 
+  //  Stuff the 2-bit codes of the len bases of s (reverse complemented if flip) in chunks
+  //    of up to 32 bases = one IO_UTYPE word at a time.  Return the first 4 bases in *pref.
+
 static inline IO_UTYPE *Stuff_Seq(char *s, int len, IO_UTYPE *buf, int *bitp, int flip, int *pref)
-{ int      rem, i;
-  IO_UTYPE val, pre4;
+{ int      i, j, n;
+  IO_UTYPE val;
 
-  rem = *bitp;
 #ifdef DEBUG_COMPRESS
-  printf("seq %d/%d b=%d/%016llx\n",len,flip,rem,*buf);
+  printf("seq %d/%d b=%d/%016llx\n",len,flip,*bitp,*buf);
 #endif
-  pre4 = 0;
   if (flip)
-    { for (i = 1; i <= 4; i++)
-        { val = Fran[(int) s[len-i]];
-          if (rem > 2)
-            { rem -= 2;
-              *buf |= (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,*buf);
-#endif
-            }
-          else if (rem == 2)
-            { *buf++ |= val;
-              rem = IO_UBITS;
-              *buf = 0;
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,buf[-1]);
-#endif
-            }
-          else
-            { *buf++ |= (val >> 1); 
-              rem  = IO_UBITS - 1;
-              *buf = (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx|%016llx\n",val,rem,buf[-1],*buf);
-#endif
-            }
-          pre4 = (pre4 << 2 | val);
-        }
-      for (i = len-5; i >= 0; i--)
-        { val = Fran[(int) s[i]];
-          if (rem > 2)
-            { rem -= 2;
-              *buf |= (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,*buf);
-#endif
-            }
-          else if (rem == 2)
-            { *buf++ |= val;
-              rem = IO_UBITS;
-              *buf = 0;
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,buf[-1]);
-#endif
-            }
-          else
-            { *buf++ |= (val >> 1); 
-              rem  = IO_UBITS - 1;
-              *buf = (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx|%016llx\n",val,rem,buf[-1],*buf);
-#endif
-            }
+    { *pref = (Fran[(int) s[len-1]] << 6) | (Fran[(int) s[len-2]] << 4)
+            | (Fran[(int) s[len-3]] << 2) |  Fran[(int) s[len-4]];
+      for (i = len; i > 0; i -= n)
+        { n = (i > 32 ? 32 : i);
+          val = 0;
+          for (j = i-1; j >= i-n; j--)
+            val = (val << 2) | Fran[(int) s[j]];
+          buf = Stuff_Int(val,2*n,buf,bitp);
         }
     }
   else
-    { for (i = 0; i < 4; i++)
-        { val = Dran[(int) s[i]];
-          if (rem > 2)
-            { rem -= 2;
-              *buf |= (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,*buf);
-#endif
-            }
-          else if (rem == 2)
-            { *buf++ |= val;
-              rem = IO_UBITS;
-              *buf = 0;
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,buf[-1]);
-#endif
-            }
-          else
-            { *buf++ |= (val >> 1); 
-              rem  = IO_UBITS - 1;
-              *buf = (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx|%016llx\n",val,rem,buf[-1],*buf);
-#endif
-            }
-          pre4 = (pre4 << 2 | val);
-        }
-      for (i = 4; i < len; i++)
-        { val = Dran[(int) s[i]];
-          if (rem > 2)
-            { rem -= 2;
-              *buf |= (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,*buf);
-#endif
-            }
-          else if (rem == 2)
-            { *buf++ |= val;
-              rem = IO_UBITS;
-              *buf = 0;
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx\n",val,rem,buf[-1]);
-#endif
-            }
-          else
-            { *buf++ |= (val >> 1); 
-              rem  = IO_UBITS - 1;
-              *buf = (val << rem);
-#ifdef DEBUG_COMPRESS
-              printf("  %llx: b = %2d/%016llx|%016llx\n",val,rem,buf[-1],*buf);
-#endif
-            }
+    { *pref = (Dran[(int) s[0]] << 6) | (Dran[(int) s[1]] << 4)
+            | (Dran[(int) s[2]] << 2) |  Dran[(int) s[3]];
+      for (i = 0; i < len; i += n)
+        { n = (len-i > 32 ? 32 : len-i);
+          val = 0;
+          for (j = i; j < i+n; j++)
+            val = (val << 2) | Dran[(int) s[j]];
+          buf = Stuff_Int(val,2*n,buf,bitp);
         }
     }
 #ifdef DEBUG_COMPRESS
-  printf("   pref = %llx\n",pre4);
+  printf("   pref = %x\n",*pref);
 #endif
-  *bitp = rem;
-  *pref = (int) pre4;
   return (buf);
 }
 
@@ -998,19 +1074,179 @@ typedef struct
     IO_UTYPE *bptrs;       //  Current word being stuffered in buffer
     IO_UTYPE *data;        //  End of buffer (start is at data-IO_BUF_LEN)
     int       nbits;       //  # of bits for last profile write (if DO_PROFILE)
+    IO_UTYPE *core;        //  If IN_CORE then start of buffer (which grows instead of flushing)
+    struct libdeflate_compressor *zipper;   //  If ZIP_SMERS then compressor and output buffer
+    uint8    *zbuf;                         //    for the thread (shared by all its parts)
+    int64     zlen;
   } Min_File;
 
+static int64 core_slack;   //  # of words beyond data allocated for an IN_CORE buffer
+
+  //  Write nwords of super-mer data at start to the stream of trg, if ZIP_SMERS then as a
+  //    compressed block preceded by its uncompressed and compressed lengths
+
+static int write_super(Min_File *trg, IO_UTYPE *start, int64 nwords)
+{ uint32 len[2];
+
+  if (!ZIP_SMERS)
+    return (write(trg->stream,start,IO_UBYTES*nwords));
+
+  len[0] = IO_UBYTES*nwords;
+  len[1] = libdeflate_deflate_compress(trg->zipper,start,len[0],trg->zbuf,trg->zlen);
+  if (len[1] == 0)
+    { fprintf(stderr,"%s: Compression of super-mer block failed\n",Prog_Name);
+      Clean_Exit(1);
+    }
+  if (write(trg->stream,len,2*sizeof(uint32)) < 0)
+    return (-1);
+  return (write(trg->stream,trg->zbuf,len[1]));
+}
+
+  //  Buffer of trg is full at ptr: write it out, or if IN_CORE, double its size
+
+static IO_UTYPE *flush_super(Min_File *trg, IO_UTYPE *ptr)
+{ IO_UTYPE *start;
+  int64     len, off;
+
+  if (IN_CORE)
+    { off   = ptr - trg->core;
+      len   = 2*(trg->data - trg->core);
+      start = Realloc(trg->core,(len+core_slack)*IO_UBYTES,"Growing super-mer list");
+      if (start == NULL)
+        Clean_Exit(1);
+      trg->core = start;
+      trg->data = start + len;
+      return (start + off);
+    }
+
+  start = trg->data - IO_BUF_LEN;
+  if (write_super(trg,start,ptr-start) < 0)
+    { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,trg->sname);
+      Clean_Exit(1);
+    }
+  *start = *ptr;
+  return (start);
+}
+
   //  State for each thread between calls with a block of data
 
 static Min_File **ogroup;   //  Vector of bucket files
 static int64     *nfirst;   //  # of super-mers generated so far
 static int       *nmbits;   //  # of bits currently being used for super-mer indices (if -p)
-static int       *totrds;   //  # of reads processed
+static int64     *totrds;   //  # of reads processed
 static int64     *totbps;   //  # of bps processed
 static int    short_read;   //   There was at least one read < KMER (after prefix removal)
 static FILE     **nstream;  //  Thread file for invalid intervals
+static uint64   **minval;   //  Padded minimizers of a window of the current read
+static uint8    **minflp;   //  Their orientations (1 if from the reverse complement)
 static char     **nname;    //  Thread file name for invalid intervals
 
+  //  The padded minimizers of a read are computed MIN_WINDOW positions at a time into a
+  //    window buffer that also keeps the MOD_LEN positions before them, enough for the
+  //    re-scan of a super-mer that has reached MAX_SUPER (< KMER) k-mers.  So the buffer
+  //    stays cache-resident and its size is fixed regardless of the length of a read.
+
+#define MIN_WINDOW 4096
+
+  //  Compute the padded minimizer of every position p in [PAD_L1,q) of s in min[p], and in
+  //    flp[p] whether it is that of the reverse complement strand, in one branch-free pass
+  //    ahead of the branchy scan for super-mer boundaries.  The scan is over [p,e) where
+  //    cu[0] and cu[1] are the rolling forward and reverse codes of s[0..p-1].
+
+static void Padded_Minimizers(char *s, int p, int e, uint64 *cu, uint64 *min, uint8 *flp)
+{ uint64 c, u, f;
+  int    x;
+
+  c = cu[0];
+  u = cu[1];
+  for ( ; p < PAD_L1 && p < e; p++)
+    { x = s[p];
+      c = (c << 2) | Tran[x];
+      u = (u >> 2) | Cran[x];
+    }
+  for ( ; p < e; p++)
+    { x = s[p];
+      c = ((c << 2) | Tran[x]) & PAD_MSK;
+      u = (u >> 2) | Cran[x];
+      f = (u < c);
+      flp[p] = f;
+      min[p] = c ^ ((c ^ u) & -f);
+    }
+  cu[0] = c;
+  cu[1] = u;
+}
+
+  //  The window [*wbeg,p) of minimizers in minb & flpb is exhausted: slide its last
+  //    MOD_LEN positions to the front and compute the next MIN_WINDOW after them, returning
+  //    the new end of the window.
+
+static int Next_Window(char *s, int p, int q, int *wbeg, uint64 *cu, uint64 *minb, uint8 *flpb)
+{ int b, e;
+
+  b = p - MOD_LEN;
+  if (b < *wbeg)
+    b = *wbeg;
+  memmove(minb,minb+(b - *wbeg),sizeof(uint64)*(p-b));
+  memmove(flpb,flpb+(b - *wbeg),sizeof(uint8)*(p-b));
+  *wbeg = b;
+
+  e = p + MIN_WINDOW;
+  if (e > q)
+    e = q;
+  Padded_Minimizers(s,p,e,cu,minb-b,flpb-b);
+  return (e);
+}
+
+  //  Return the index of the last minimum of min[b..e].  With AVX2 four lanes keep the
+  //    minimum and its index of every 4th position, with a compare and blend in place of the
+  //    64-bit unsigned min that AVX2 lacks (padded minimizers are < 2^62 so a signed compare
+  //    suffices), and the lanes are then reduced.  Otherwise, or for a short range, a scalar
+  //    scan.
+
+static inline int Window_Min(uint64 *min, int b, int e)
+{ uint64 mc;
+  int    m, n;
+
+  m = b;
+#ifdef __AVX2__
+  if (e-b >= 8)
+    { __m256i bv, bi, ci, v, g;
+      int64   lv[4], li[4];
+      int     j;
+
+      bv = _mm256_loadu_si256((__m256i *) (min+b));
+      bi = _mm256_set_epi64x(b+3,b+2,b+1,b);
+      ci = bi;
+      for (n = b+4; n+3 <= e; n += 4)
+        { ci = _mm256_add_epi64(ci,_mm256_set1_epi64x(4));
+          v  = _mm256_loadu_si256((__m256i *) (min+n));
+          g  = _mm256_cmpgt_epi64(v,bv);
+          bv = _mm256_blendv_epi8(v,bv,g);
+          bi = _mm256_blendv_epi8(ci,bi,g);
+        }
+      _mm256_storeu_si256((__m256i *) lv,bv);
+      _mm256_storeu_si256((__m256i *) li,bi);
+      m = li[0];
+      for (j = 1; j < 4; j++)
+        if (lv[j] < lv[0] || (lv[j] == lv[0] && li[j] > m))
+          { lv[0] = lv[j];
+            m     = li[j];
+          }
+      mc = lv[0];
+    }
+  else
+#endif
+    { mc = min[b];
+      n  = b+1;
+    }
+  for ( ; n <= e; n++)
+    if (min[n] <= mc)
+      { m  = n;
+        mc = min[n];
+      }
+  return (m);
+}
+
 void Distribute_Block(DATA_BLOCK *block, int tid)
 { int    nreads  = block->nreads;
   char  *bases   = block->bases;
@@ -1028,12 +1264,15 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
 #endif
 
   int        force;
-  int        i, p, q, x, w;
-  uint64     c, u;
+  int        i, p, q, x;
   char      *s, *t, *r;
 
-  uint64     min[MOD_LEN];
-  uint32     flp[MOD_LEN];
+  uint64    *minb = minval[tid];
+  uint8     *flpb = minflp[tid];
+  uint64    *min;
+  uint8     *flp;
+  uint64     cu[2];
+  int        wbeg, wend;
   uint64     mp, mc;
   int        m, n, b, y, o;
   int        last;
@@ -1046,7 +1285,7 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
   int       *bit;
 
 #if defined(SHOW_PACKETS)
-  int rbase = totrds[tid];
+  int64 rbase = totrds[tid];
   if (DO_PROFILE)
     printf("Index at %lld (%d/%lld)\n",nidx,nbits,nlim);
 #endif
@@ -1078,33 +1317,36 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
         { nidx += 1;
 #ifdef SHOW_PACKETS
           if (PACKET < 0)
-            printf("READ %d %lld\n  %6lld:   EMPTY\n",rbase+(i+1),nidx-1,nidx-1);
+            printf("READ %lld %lld\n  %6lld:   EMPTY\n",rbase+(i+1),nidx-1,nidx-1);
 #endif
           continue;
         }
 
 #if defined(DEBUG_DISTRIBUTE) || defined(SHOW_PACKETS)
-      printf("READ %d %lld\n",rbase+(i+1),nidx);
+      printf("READ %lld %lld\n",rbase+(i+1),nidx);
       fflush(stdout);
 #endif
+      cu[0] = cu[1] = 0;
+      wbeg  = wend = 0;
+      min   = minb;
+      flp   = flpb;
+
       m  = 0;
       mc = PAD_TOT;
-      c = u = 0;
       nlst = nfst = plst = -1;
       for (p = 0; p < KMER; p++)
-        { x = s[p];
-          c = ((c << 2) | Tran[x]) & PAD_MSK;
-          u = (u >> 2) | Cran[x];
+        { if (p >= wend)
+            { wend = Next_Window(s,p,q,&wbeg,cu,minb,flpb);
+              min  = minb - wbeg;
+              flp  = flpb - wbeg;
+            }
+          x = s[p];
 #ifdef DEBUG_DISTRIBUTE
-          printf(" %5d: %c %0*llx %0*llx",p,x,P,c,P,u);
+          printf(" %5d: %c",p,x);
           fflush(stdout);
 #endif    
           if (p >= PAD_L1)
-            { if ((flp[p] = (u < c)))
-                mp = u;
-              else
-                mp = c;
-              min[p] = mp;
+            { mp = min[p];
               if (mp < mc)
                 { m  = p;
                   mc = mp;
@@ -1132,15 +1374,13 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
 
       last = KMER-1;
       for (p = KMER; p < q; p++)
-        { x = s[p];
-          c = ((c << 2) | Tran[x]) & PAD_MSK;
-          u = (u >> 2) | Cran[x];
-          w = p & MOD_MSK;
-          if ((flp[w] = (u < c)))
-            mp = u;
-          else
-            mp = c;
-          min[w] = mp;
+        { if (p >= wend)
+            { wend = Next_Window(s,p,q,&wbeg,cu,minb,flpb);
+              min  = minb - wbeg;
+              flp  = flpb - wbeg;
+            }
+          x  = s[p];
+          mp = min[p];
 
           force = (p-m >= MAX_SUPER);
         one_more:
@@ -1229,7 +1469,7 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
               else
                 n = p-last;
 
-              if (n > 0)
+              if (n > 0 && PASS_BEG <= b && b < PASS_END)
                 { trg = out + b;
                   trg->kmers += n--;
                   trg->nmers += 1;
@@ -1257,15 +1497,7 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
                         { tlim = (0x1ll << (tbits-1));
                           ptr = Stuff_Int(tlim,tbits,ptr,bit);
                           if (ptr >= trg->data)
-                            { IO_UTYPE *start = trg->data - IO_BUF_LEN;
-                              if (write(trg->stream,start,IO_UBYTES*(ptr-start)) < 0)
-                                { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
-                                                 Prog_Name,trg->sname);
-                                  Clean_Exit(1);
-                                }
-                              *start = *ptr;
-                              ptr = start;
-                            }
+                            ptr = flush_super(trg,ptr);
                           trg->nbits = ++tbits;
 #ifdef SHOW_PACKETS
                           if (PACKET < 0 || b == PACKET)
@@ -1276,40 +1508,37 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
                     }
 
                   else
-                    { ptr = Stuff_Seq(r+last,n,ptr,bit,flp[m & MOD_MSK],prep);
+                    { ptr = Stuff_Seq(r+last,n,ptr,bit,flp[m],prep);
                       trg->fours[pref] += 1;
                     }
 
 #ifdef SHOW_PACKETS
                   if (PACKET < 0 || b == PACKET)
                     printf("   %6lld: %5d/%2d: %.*s[%c,%02x] %d\n",
-                           nidx,last,n,n,r+last,flp[m & MOD_MSK]?'-':'+',pref,b);
+                           nidx,last,n,n,r+last,flp[m]?'-':'+',pref,b);
                   fflush(stdout);
 #endif
 
                   nidx += 1;
                   if (ptr >= trg->data)
-                    { IO_UTYPE *start = trg->data - IO_BUF_LEN;
-                      if (write(trg->stream,start,IO_UBYTES*(ptr-start)) < 0)
-                        { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
-                                         Prog_Name,trg->sname);
-                          Clean_Exit(1);
-                        }
-                      *start = *ptr;
-                      ptr = start;
-                    }
+                    ptr = flush_super(trg,ptr);
                   trg->bptrs = ptr;
                 }
 
-              if (force)
-                { mc = min[(++m) & MOD_MSK];
-                  for (n = m+1; n <= p; n++)
-                    { mp = min[n & MOD_MSK];
-                      if (mp <= mc)
-                        { m  = n;
-                          mc = mp;
-                        }
+              //  A super-mer of a part of another pass is only counted (to size the passes),
+              //    but still takes up an index as it would in a single pass
+
+              else if (n > 0)
+                { if (b < NPARTS)
+                    { out[b].kmers += n;
+                      out[b].nmers += 1;
                     }
+                  nidx += 1;
+                }
+
+              if (force)
+                { m  = Window_Min(min,m+1,p);
+                  mc = min[m];
                 }
               else
                 { m  = p;
@@ -1329,8 +1558,7 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
 
 #ifdef DEBUG_DISTRIBUTE
           if (p < q)
-            printf(" %5d: %c %0*llx %0*llx <%5d:%0*llx%c>\n",p,x,P,c,P,u,m,P,mc,
-                                                             flp[m&MOD_MSK]?'-':'+');
+            printf(" %5d: %c %0*llx <%5d:%0*llx%c>\n",p,x,P,min[p],m,P,mc,flp[m]?'-':'+');
           else
             printf(" <<\n");
           fflush(stdout);
@@ -1400,12 +1628,107 @@ void Distribute_Block(DATA_BLOCK *block, int tid)
  *
  *********************************************************************************************/
 
+/*******************************************************************************************
+ *
+ *  DISK BUDGET
+ *
+ *    int Next_Pass(int beg, int64 kmers)
+ *
+ *       If there is a disk budget (-D) then the parts are distributed and sorted in several
+ *       passes over the input, each of which writes only the super-mer files of the parts
+ *       [PASS_BEG,PASS_END) while counting the k-mers and super-mers of all the others.
+ *       Given the first part of the next pass, Next_Pass returns the end of the longest run
+ *       of parts whose estimated files fit in the budget (at least one part).  Before the
+ *       first pass the parts are assumed to be of equal size, kmers/NPARTS, with every k-mer
+ *       in a super-mer of its own.  Thereafter the counts of the last pass are used, and a
+ *       warning is given if a part alone is over the budget.
+ *
+ ********************************************************************************************/
+
+#define HEADER_BYTES  (258*sizeof(int64))
+
+static int64 *Part_Bytes = NULL;   //  [i] = estimated # of bytes in the files of part i
+
+  //  Set Part_Bytes from the counts of the pass just made, scaled by the ratio of the bytes
+  //    actually written for the parts of the pass (fbytes) to the bits their super-mers encode
+
+static void size_parts(Min_File *out, int64 fbytes)
+{ int64  wbits, pbits;
+  double ratio;
+  int    sbits;
+  int    n, t, p;
+
+  if (Part_Bytes == NULL)
+    return;
+
+  sbits = SLEN_BITS + 2*(KMER-1);
+  if (DO_PROFILE)
+    sbits += RUN_BITS;
+
+  wbits = 0;
+  for (n = PASS_BEG; n < PASS_END; n++)
+    for (t = 0; t < ITHREADS; t++)
+      { p = t*NPARTS + n;
+        wbits += out[p].nmers*sbits + 2*out[p].kmers;
+      }
+  fbytes -= (PASS_END-PASS_BEG)*ITHREADS*HEADER_BYTES;
+  if (wbits == 0 || fbytes <= 0)
+    ratio = 1./8.;
+  else
+    ratio = (1.*fbytes)/wbits;
+
+  for (n = 0; n < NPARTS; n++)
+    { pbits = 0;
+      for (t = 0; t < ITHREADS; t++)
+        { p = t*NPARTS + n;
+          pbits += out[p].nmers*sbits + 2*out[p].kmers;
+        }
+      Part_Bytes[n] = pbits*ratio + ITHREADS*HEADER_BYTES;
+    }
+}
+
+int Next_Pass(int beg, int64 kmers)
+{ int64 sum;
+  int   n;
+
+  if (DISK_BUDGET == 0)
+    return (NPARTS);
+
+  if (Part_Bytes == NULL)
+    { Part_Bytes = (int64 *) Malloc(sizeof(int64)*NPARTS,"Allocating part sizes");
+      if (Part_Bytes == NULL)
+        Clean_Exit(1);
+      for (n = 0; n < NPARTS; n++)
+        Part_Bytes[n] = ((kmers/NPARTS) * (SLEN_BITS + 2*KMER + (DO_PROFILE?40:0)))/8
+                      + ITHREADS*HEADER_BYTES;
+    }
+
+  if (beg > 0 && Part_Bytes[beg] > DISK_BUDGET)
+    fprintf(stderr,"%s: Warning: block %d is estimated at %.1fGB, over the disk budget\n",
+                   Prog_Name,beg+1,Part_Bytes[beg]/1.e9);
+
+  sum = Part_Bytes[beg];
+  for (n = beg+1; n < NPARTS; n++)
+    { sum += Part_Bytes[n];
+      if (sum > DISK_BUDGET)
+        break;
+    }
+
+  if (n >= NPARTS)
+    { free(Part_Bytes);
+      Part_Bytes = NULL;
+    }
+  return (n);
+}
+
 int64 *NUM_RID;   //  [i] for i in [0,NTHREADS) = # of super-mers per vertical stripe
 
+Core_List *CORE_LIST;   //  [i] for i in [0,ITHREADS) = in-memory super-mer list (if IN_CORE)
+
 void Split_Kmers(Input_Partition *io, char *root)
 { int           overflow;
   uint64        nfiles;
-  int           nreads;
+  int64         nreads;
   int64         totlen;
   int64         nids;
 
@@ -1422,15 +1745,27 @@ void Split_Kmers(Input_Partition *io, char *root)
 
   MAX_NRUN = 1+126*MAX_SUPER;
 
+  core_slack = overflow - IO_BUF_LEN;
+
   out     = (Min_File *) Malloc(nfiles*sizeof(Min_File),"Allocating buffers");
-  buffers = (IO_UTYPE *) Malloc(nfiles*overflow*IO_UBYTES,"Allocating buffers");
+  if (IN_CORE)
+    buffers = NULL;
+  else
+    buffers = (IO_UTYPE *) Malloc(nfiles*overflow*IO_UBYTES,"Allocating buffers");
   nstream = (FILE **) Malloc(ITHREADS*sizeof(FILE *),"Allocating buffer");
   nname   = (char **) Malloc(ITHREADS*sizeof(char *),"Allocating buffer");
-  if (out == NULL || buffers == NULL || nstream == NULL || nname == NULL)
+  if (out == NULL || (buffers == NULL && !IN_CORE) || nstream == NULL || nname == NULL)
     Clean_Exit(1);
 
   if (VERBOSE)
-    { fprintf(stderr,"\nPhase 1: Partitioning K-mers into %lld Super-mer Files\n",nfiles);
+    { if (IN_CORE)
+        fprintf(stderr,"\nPhase 1: Partitioning K-mers into %lld In-Memory Super-mer Lists\n",
+                       nfiles);
+      else if (PASS_END-PASS_BEG < NPARTS)
+        fprintf(stderr,"\nPhase 1: Partitioning K-mers of blocks %d-%d into %d Super-mer Files\n",
+                       PASS_BEG+1,PASS_END,(PASS_END-PASS_BEG)*ITHREADS);
+      else
+        fprintf(stderr,"\nPhase 1: Partitioning K-mers into %lld Super-mer Files\n",nfiles);
       fflush(stderr);
     }
 
@@ -1440,7 +1775,7 @@ void Split_Kmers(Input_Partition *io, char *root)
     char  *fname;
     int64 _zero = 0, *zero = &_zero;
 
-    fname = (char *) Malloc(strlen(SORT_PATH)+strlen(root)+100,"Allocating file names");
+    fname = (char *) Malloc(SORT_PLEN+strlen(root)+100,"Allocating file names");
     if (fname == NULL)
       Clean_Exit(1);
 
@@ -1449,11 +1784,39 @@ void Split_Kmers(Input_Partition *io, char *root)
       for (n = 0; n < NPARTS; n++)
         { int f, i;
 
-          sprintf(fname,"%s/%s.%d.T%d",SORT_PATH,root,n,t);
+          if (IN_CORE)
+            { out[p].stream = -1;
+              out[p].sname  = NULL;
+              out[p].kmers  = 0;
+              out[p].nmers  = 0;
+              for (i = 0; i < 256; i++)
+                out[p].fours[i] = 0;
+              out[p].core   = Malloc(overflow*IO_UBYTES,"Allocating super-mer list");
+              if (out[p].core == NULL)
+                Clean_Exit(1);
+              out[p].bptrs  = out[p].core;
+              out[p].data   = out[p].core + IO_BUF_LEN;
+              out[p].bbits  = IO_UBITS;
+              out[p].nbits  = 17;
+              *(out[p].bptrs) = 0;
+              p += 1;
+              continue;
+            }
+
+          if (n < PASS_BEG || n >= PASS_END)    //  Part of another pass: only counted
+            { out[p].stream = -1;
+              out[p].sname  = NULL;
+              out[p].kmers  = 0;
+              out[p].nmers  = 0;
+              p += 1;
+              continue;
+            }
+
+          sprintf(fname,"%s/%s.%d.T%d",Sort_Path(n,t),root,n,t);
           f = open(fname,O_CREAT|O_TRUNC|O_WRONLY,S_IRWXU);
           if (f == -1)
             { fprintf(stderr,"\n%s: Cannot open external files in %s\n",
-                             Prog_Name,SORT_PATH);
+                             Prog_Name,Sort_Path(n,t));
               Clean_Exit(1);
             }
 
@@ -1465,6 +1828,27 @@ void Split_Kmers(Input_Partition *io, char *root)
           out[p].nmers  = 0;
           for (i = 0; i < 256; i++)
             out[p].fours[i] = 0;
+          out[p].core   = NULL;
+          if (!ZIP_SMERS)
+            { out[p].zipper = NULL;
+              out[p].zbuf   = NULL;
+            }
+          else if (n > PASS_BEG)
+            { out[p].zipper = out[p-1].zipper;
+              out[p].zbuf   = out[p-1].zbuf;
+              out[p].zlen   = out[p-1].zlen;
+            }
+          else
+            { out[p].zipper = libdeflate_alloc_compressor(1);
+              if (out[p].zipper == NULL)
+                { fprintf(stderr,"\n%s: Could not allocate compressor\n",Prog_Name);
+                  Clean_Exit(1);
+                }
+              out[p].zlen = libdeflate_deflate_compress_bound(out[p].zipper,overflow*IO_UBYTES);
+              out[p].zbuf = Malloc(out[p].zlen,"Allocating compression buffer");
+              if (out[p].zbuf == NULL)
+                Clean_Exit(1);
+            }
           out[p].bptrs  = buffers + p*overflow;
           out[p].data   = buffers + p*overflow + IO_BUF_LEN;
           out[p].bbits  = IO_UBITS;
@@ -1510,12 +1894,16 @@ void Split_Kmers(Input_Partition *io, char *root)
     int64 val;
 
     nfirst = Malloc(sizeof(int64)*ITHREADS,"Allocating distribution globals");
-    totbps = Malloc(sizeof(int64)*ITHREADS,"Allocating distribution globals");
-    nmbits = Malloc(sizeof(int)*2*ITHREADS,"Allocating distribution globals");
+    totbps = Malloc(sizeof(int64)*2*ITHREADS,"Allocating distribution globals");
+    nmbits = Malloc(sizeof(int)*ITHREADS,"Allocating distribution globals");
     ogroup = Malloc(sizeof(Min_File *)*ITHREADS,"Allocating distribution globals");
-    totrds = nmbits + ITHREADS;
+    minval = Malloc(sizeof(uint64 *)*ITHREADS,"Allocating distribution globals");
+    minflp = Malloc(sizeof(uint8 *)*ITHREADS,"Allocating distribution globals");
+    totrds = totbps + ITHREADS;
     if (nfirst == NULL || nmbits == NULL || ogroup == NULL)
       Clean_Exit(1);
+    if (minval == NULL || minflp == NULL)
+      Clean_Exit(1);
 
     short_read = 0;
     for (i = 0; i < ITHREADS; i++)
@@ -1524,6 +1912,10 @@ void Split_Kmers(Input_Partition *io, char *root)
         ogroup[i] = out + i*NPARTS;
         totrds[i] = 0;
         totbps[i] = 0;
+        minval[i] = Malloc(sizeof(uint64)*(MOD_LEN+MIN_WINDOW+1),"Allocating minimizers");
+        minflp[i] = Malloc(sizeof(uint8)*(MOD_LEN+MIN_WINDOW+1),"Allocating minimizers");
+        if (minval[i] == NULL || minflp[i] == NULL)
+          Clean_Exit(1);
       }
 
     Scan_All_Input(io);
@@ -1549,6 +1941,12 @@ void Split_Kmers(Input_Partition *io, char *root)
       RUN_BITS += 1;
     RUN_BYTES = (RUN_BITS+7) >> 3;
 
+    for (i = 0; i < ITHREADS; i++)
+      { free(minval[i]);
+        free(minflp[i]);
+      }
+    free(minflp);
+    free(minval);
     free(ogroup);
     free(nmbits);
     free(totbps);
@@ -1565,7 +1963,7 @@ void Split_Kmers(Input_Partition *io, char *root)
 
     ktot = 0;
     ntot = 0;
-    for (n = 0; n < NPARTS; n++)
+    for (n = PASS_BEG; n < PASS_END; n++)
       { p = n;
         s = m = 0;
         for (t = 0; t < ITHREADS; t++)
@@ -1580,7 +1978,7 @@ void Split_Kmers(Input_Partition *io, char *root)
     awide = kwide = nwide = 0;
     if (VERBOSE)
       { fprintf(stderr,"  There are ");
-        Print_Number((int64) nreads,0,stderr);
+        Print_Number(nreads,0,stderr);
         fprintf(stderr," reads totalling ");
         Print_Number(totlen,0,stderr);
         fprintf(stderr," bps\n");
@@ -1607,7 +2005,7 @@ void Split_Kmers(Input_Partition *io, char *root)
     if (VERBOSE)
       fprintf(stderr,"\n     Part:%*s%d-mer%*ssuper-mers%*save. length\n",
                      (kwide-Number_Digits(KMER))-2,"",KMER,nwide-8,"",awide-9,"");
-    for (n = 0; n < NPARTS; n++)
+    for (n = PASS_BEG; n < PASS_END; n++)
       { p = n;
         s = m = 0;
         for (t = 0; t < ITHREADS; t++)
@@ -1664,41 +2062,80 @@ void Split_Kmers(Input_Partition *io, char *root)
           free(nname[t]);
         }
 
-    p = 0;
-    for (t = 0; t < ITHREADS; t++)
-      for (n = 0; n < NPARTS; n++)
-        { int       f     = out[p].stream;
-          IO_UTYPE *start = out[p].data - IO_BUF_LEN;
+    if (IN_CORE)
+      { CORE_LIST = Malloc(sizeof(Core_List)*ITHREADS,"Allocating super-mer lists");
+        if (CORE_LIST == NULL)
+          Clean_Exit(1);
+        for (t = 0; t < ITHREADS; t++)
+          { Core_List *c = CORE_LIST + t;
+            int64      len;
+
+            out[t].bptrs = Stuff_Int(0,SLEN_BITS,out[t].bptrs,&(out[t].bbits));
+            len = (out[t].bptrs - out[t].core) + 1;
+
+            c->kmers = out[t].kmers;
+            c->nmers = out[t].nmers;
+            memcpy(c->fours,out[t].fours,sizeof(int64)*256);
+            c->data  = Realloc(out[t].core,(len+IO_BUF_LEN)*IO_UBYTES,"Trimming super-mer list");
+            c->dlen  = len;
+            if (c->data == NULL)
+              Clean_Exit(1);
+          }
+      }
 
-          out[p].bptrs = Stuff_Int(0,SLEN_BITS,out[p].bptrs,&(out[p].bbits));
+    else
+      { int64 fbytes;
 
-          if (out[p].bptrs > start || out[p].bbits < IO_UBITS)
-            write(f,start,IO_UBYTES*((out[p].bptrs-start)+1));
+        fbytes = 0;
+        p = 0;
+        for (t = 0; t < ITHREADS; t++)
+          for (n = 0; n < NPARTS; n++)
+            { int       f     = out[p].stream;
+              IO_UTYPE *start = out[p].data - IO_BUF_LEN;
 
-          lseek(f,0,SEEK_SET);
+              if (f < 0)
+                { p += 1;
+                  continue;
+                }
+
+              out[p].bptrs = Stuff_Int(0,SLEN_BITS,out[p].bptrs,&(out[p].bbits));
+
+              if (out[p].bptrs > start || out[p].bbits < IO_UBITS)
+                write_super(out+p,start,(out[p].bptrs-start)+1);
+
+              fbytes += lseek(f,0,SEEK_END);
+              lseek(f,0,SEEK_SET);
 #ifdef DEVELOPER
-          write(f,&KMAX,sizeof(int64));
-          write(f,&NMAX,sizeof(int64));
-          write(f,&KMAX_BYTES,sizeof(int));
-          write(f,&RUN_BITS,sizeof(int));
-          write(f,nfirst+t,sizeof(int64));
-#endif
-          write(f,&(out[p].kmers),sizeof(int64));
-          write(f,&(out[p].nmers),sizeof(int64));
-          if (write(f,out[p].fours,sizeof(int64)*256) < 0)
-            { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
-                             Prog_Name,out[p].sname);
-              Clean_Exit(1);
+              write(f,&KMAX,sizeof(int64));
+              write(f,&NMAX,sizeof(int64));
+              write(f,&KMAX_BYTES,sizeof(int));
+              write(f,&RUN_BITS,sizeof(int));
+              write(f,nfirst+t,sizeof(int64));
+#endif
+              write(f,&(out[p].kmers),sizeof(int64));
+              write(f,&(out[p].nmers),sizeof(int64));
+              if (write(f,out[p].fours,sizeof(int64)*256) < 0)
+                { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",
+                                 Prog_Name,out[p].sname);
+                  Clean_Exit(1);
+                }
+              close(f);
+              free(out[p].sname);
+              if (ZIP_SMERS && n == PASS_END-1)
+                { libdeflate_free_compressor(out[p].zipper);
+                  free(out[p].zbuf);
+                }
+              p += 1;
             }
-          close(f);
-          free(out[p].sname);
-          p += 1;
-        }
+
+        size_parts(out,fbytes);
+      }
   }
 
 #ifdef DEVELOPER
   free(nfirst);
 #else
+  free(NUM_RID);
   NUM_RID = nfirst;
 #endif
   free(nname);
@@ -1706,7 +2143,7 @@ void Split_Kmers(Input_Partition *io, char *root)
   free(buffers);
   free(out);
 
-  if (PRO_TABLE == NULL)
+  if ((PRO_TABLE == NULL || PASS_BEG > 0) && PASS_END == NPARTS)
     free(Min_Part);
 }
 
@@ -1968,7 +2405,7 @@ void Split_Table(char *root)
   { int    t, p, n;
     int64 _zero = 0, *zero = &_zero;
 
-    fname = (char *) Malloc(strlen(SORT_PATH)+strlen(root)+100,"Allocating file names");
+    fname = (char *) Malloc(SORT_PLEN+strlen(root)+100,"Allocating file names");
     if (fname == NULL)
       Clean_Exit(1);
 
@@ -1977,11 +2414,11 @@ void Split_Table(char *root)
       for (n = 0; n < NPARTS; n++)
         { int f;
 
-          sprintf(fname,"%s/.%s.U%d.ktab.%d",SORT_PATH,root,n,t+1);
+          sprintf(fname,"%s/.%s.U%d.ktab.%d",Sort_Path(n,0),root,n,t+1);
           f = open(fname,O_CREAT|O_TRUNC|O_WRONLY,S_IRWXU);
           if (f == -1)
             { fprintf(stderr,"\n%s: Cannot open external files in %s\n",
-                             Prog_Name,SORT_PATH);
+                             Prog_Name,Sort_Path(n,0));
               Clean_Exit(1);
             }
 
@@ -2102,11 +2539,11 @@ void Split_Table(char *root)
       }
 
     for (n = 0; n < NPARTS; n++)
-      { sprintf(fname,"%s/%s.U%d.ktab",SORT_PATH,root,n);
+      { sprintf(fname,"%s/%s.U%d.ktab",Sort_Path(n,0),root,n);
         f = open(fname,O_CREAT|O_TRUNC|O_WRONLY,S_IRWXU);
         if (f == -1)
           { fprintf(stderr,"\n%s: Cannot open external files in %s\n",
-                           Prog_Name,SORT_PATH);
+                           Prog_Name,Sort_Path(n,0));
             Clean_Exit(1);
           }
         write(f,&KMER,sizeof(int));
@@ -2125,5 +2562,6 @@ void Split_Table(char *root)
   free(fname);
   free(buffers);
   free(out);
-  free(Min_Part);
+  if (PASS_END == NPARTS)     //  Otherwise still needed by the next pass of Split_Kmers
+    free(Min_Part);
 }
@@ -1,7 +1,7 @@
 /*******************************************************************************************
  *
- *  Phase 3 of FastK: Given NPARTS sorted k-mer count table files for NTHREADS threads,
- *    merge in k-mer order the NPARTS files (in directory SORT_PATH) for each thread
+ *  Phase 3 of FastK: Given NPARTS sorted k-mer count table files for NTABLES table parts,
+ *    merge in k-mer order the NPARTS files (in the -P directories) for each part
  *    into a single k-mer tables (in directory "path").
  *
  *  Author:  Gene Myers
@@ -24,6 +24,7 @@
 #include <errno.h>
 
 #include "libfastk.h"
+#include "kmer_ops.h"
 #include "FastK.h"
 
 #undef    DEBUG
@@ -49,19 +50,6 @@ static void print_kmer(uint8 *str, int len)
 
 #endif
 
-static inline int mycmp(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    { if (*a++ != *b++)
-        return (a[-1] < b[-1] ? 0 : 1);
-    }
-  return (0);
-}
-
-static inline void mycpy(uint8 *a, uint8 *b, int n)
-{ while (n--)
-    *a++ = *b++;
-}
-
 
   //  Input block data structure and block fetcher
 
@@ -82,7 +70,7 @@ static void reload(IO_block *in)
     memmove(in->block, in->ptr, del);
   in->ptr  = in->block;
   in->top  = in->block + del;
-  in->top += read(in->stream,in->top,BUFLEN_UINT8-del);
+  in->top += Read_All(in->stream,in->top,BUFLEN_UINT8-del);
 }
 
 
@@ -104,10 +92,10 @@ static void reheap(int s, IO_block **heap, int hsize)
         bigger = 1;
       else
         { hr = heap[r];
-          bigger = mycmp(hr->ptr,hl->ptr,KMER_BYTES);
+          bigger = (mycmp(hr->ptr,hl->ptr,KMER_BYTES) > 0);
         }
       if (bigger)
-        { if (mycmp(hsp,hl->ptr,KMER_BYTES))
+        { if (mycmp(hsp,hl->ptr,KMER_BYTES) > 0)
             { heap[c] = hl;
               c = l;
             }
@@ -115,7 +103,7 @@ static void reheap(int s, IO_block **heap, int hsize)
             break;
         }
       else
-        { if (mycmp(hsp,hr->ptr,KMER_BYTES))
+        { if (mycmp(hsp,hr->ptr,KMER_BYTES) > 0)
             { heap[c] = hr;
               c = r;
             }
@@ -206,7 +194,7 @@ static void *merge_table_thread(void *arg)
 
       iblock       = in[p].block;
       in[p].ptr    = iblock;
-      in[p].top    = iblock + read(in[p].stream,iblock,BUFLEN_UINT8);
+      in[p].top    = iblock + Read_All(in[p].stream,iblock,BUFLEN_UINT8);
     }
 
   //  Fill output file prolog (rewind & complete at end)
@@ -259,13 +247,13 @@ static void *merge_table_thread(void *arg)
       //  Flush output buffer if needed
 
       if (aptr + PMER_WORD > atop)
-        { int c = aptr-abuf;
+        { int64 c = aptr-abuf;
 
 #ifdef DEBUG
-          printf("Write %d bytes\n",c);
+          printf("Write %lld bytes\n",c);
 #endif
           anum += c;
-          if (write(afile,abuf,c) < 0)
+          if (Write_All(afile,abuf,c) < 0)
             { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,oname);
               Clean_Exit(1);
             }
@@ -315,10 +303,10 @@ static void *merge_table_thread(void *arg)
   //  Flush output buffer
 
   if (aptr > abuf)
-    { int c = aptr-abuf;
+    { int64 c = aptr-abuf;
 
       anum += c;
-      if (write(afile,abuf,c) < 0)
+      if (Write_All(afile,abuf,c) < 0)
         { fprintf(stderr,"%s: Cannot write to %s.  Enough disk space?\n",Prog_Name,oname);
           Clean_Exit(1);
         }
@@ -350,9 +338,9 @@ void Merge_Tables(char *path, char *root)
   uint8      *blocks;
 
 #ifndef DEBUG_MERGE
-  THREAD    threads[NTHREADS];
+  THREAD    threads[NTABLES];
 #endif
-  Track_Arg parmk[NTHREADS];
+  Track_Arg parmk[NTABLES];
   int       p, f, t, n;
 
   if (VERBOSE)
@@ -360,32 +348,46 @@ void Merge_Tables(char *path, char *root)
       fflush(stderr);
     }
 
-  fname = Malloc(2*(strlen(SORT_PATH) + strlen(path) + strlen(root)) + 100,"File name buffer");
+  fname = Malloc(2*(SORT_PLEN + strlen(path) + strlen(root)) + 100,"File name buffer");
   if (fname == NULL)
     Clean_Exit(1);
 
-  //  Allocate all working data structures
+  //  Allocate all working data structures.  The memory is divided evenly over the buffers,
+  //    but no buffer need be larger than the largest part file.
  
-  BUFLEN_UINT8 = SORT_MEMORY/((NPARTS+1)*NTHREADS);
-  if (BUFLEN_UINT8 > 0x7fffffffll)
-    BUFLEN_UINT8 = 0x7ffffff8ll;
+  BUFLEN_UINT8 = SORT_MEMORY/((NPARTS+1)*NTABLES);
+
+  { struct stat info;
+    int64       lmax;
 
-  heap   = (IO_block **) Malloc(sizeof(IO_block *)*(NPARTS+1)*NTHREADS,"Allocating heap");
-  io     = (IO_block *) Malloc(sizeof(IO_block)*(NPARTS+1)*NTHREADS,"Allocating IO buffers");
-  blocks = (uint8 *) Malloc(BUFLEN_UINT8*(NPARTS+1)*NTHREADS,"Allocating IO buffers");
+    lmax = 0;
+    for (t = 0; t < NTABLES; t++)
+      for (n = 0; n < NPARTS; n++)
+        { sprintf(fname,"%s/%s.%d.L%d",Sort_Path(n,t),root,n,t);
+          if (stat(fname,&info) == 0 && info.st_size > lmax)
+            lmax = info.st_size;
+        }
+    lmax = ((lmax+0xfffff) & ~0xfffffll) + 0x100000;
+    if (BUFLEN_UINT8 > lmax)
+      BUFLEN_UINT8 = lmax;
+  }
+
+  heap   = (IO_block **) Malloc(sizeof(IO_block *)*(NPARTS+1)*NTABLES,"Allocating heap");
+  io     = (IO_block *) Malloc(sizeof(IO_block)*(NPARTS+1)*NTABLES,"Allocating IO buffers");
+  blocks = (uint8 *) Malloc(BUFLEN_UINT8*(NPARTS+1)*NTABLES,"Allocating IO buffers");
   if (heap == NULL || io == NULL || blocks == NULL)
     Clean_Exit(1);
 
   //  Open all input files
 
-  p = NTHREADS;
-  for (t = 0; t < NTHREADS; t++)
+  p = NTABLES;
+  for (t = 0; t < NTABLES; t++)
     for (n = 0; n < NPARTS; n++)
-      { sprintf(fname,"%s/%s.%d.L%d",SORT_PATH,root,n,t);
+      { sprintf(fname,"%s/%s.%d.L%d",Sort_Path(n,t),root,n,t);
         f = open(fname,O_RDONLY);
         if (f == -1)
           { fprintf(stderr,"\n%s: Cannot open external file %s in %s\n",
-                           Prog_Name,fname,SORT_PATH);
+                           Prog_Name,fname,Sort_Path(n,t));
             Clean_Exit(1);
           }
         io[p].block  = blocks + p*BUFLEN_UINT8;
@@ -396,7 +398,7 @@ void Merge_Tables(char *path, char *root)
   //  Allocate and initialize prefix index
 
 #ifdef DEVELOPER
-  read(io[NTHREADS+NPARTS-1].stream,&IDX_BYTES,sizeof(int));
+  read(io[NTABLES+NPARTS-1].stream,&IDX_BYTES,sizeof(int));
 #endif
   PMER_WORD = TMER_WORD - IDX_BYTES;
   pidxlen   = (1 << (8*IDX_BYTES));
@@ -411,7 +413,7 @@ void Merge_Tables(char *path, char *root)
     { struct stat info;
 
       totin = 0;
-      for (p = NPARTS+NTHREADS-1; p >= NTHREADS; p--)
+      for (p = NPARTS+NTABLES-1; p >= NTABLES; p--)
         { fstat(io[p].stream,&info);
           totin += info.st_size;
         }
@@ -429,7 +431,7 @@ void Merge_Tables(char *path, char *root)
 
   //  Setup thread params and open output file
 
-  for (t = 0; t < NTHREADS; t++)
+  for (t = 0; t < NTABLES; t++)
     { sprintf(fname,"%s/.%s.ktab.%d",path,root,t+1);
       f = open(fname,O_CREAT|O_TRUNC|O_WRONLY,S_IRWXU);
       if (f == -1)
@@ -441,7 +443,7 @@ void Merge_Tables(char *path, char *root)
 
       parmk[t].out   = io + t;
       parmk[t].heap  = heap + t*(NPARTS+1);
-      parmk[t].in    = io + t*NPARTS + NTHREADS;
+      parmk[t].in    = io + t*NPARTS + NTABLES;
       parmk[t].id    = t;
       parmk[t].oname = Strdup(fname,"Allocating stream name");
       if (parmk[t].oname == NULL)
@@ -451,31 +453,32 @@ void Merge_Tables(char *path, char *root)
   //  In parallel merge part-files for each thread
 
 #ifdef DEBUG_MERGE
-  for (t = 0; t < NTHREADS; t++)
+  for (t = 0; t < NTABLES; t++)
     merge_table_thread(parmk+t);
 #else
-  for (t = 1; t < NTHREADS; t++)
+  for (t = 1; t < NTABLES; t++)
     pthread_create(threads+t,NULL,merge_table_thread,parmk+t);
   merge_table_thread(parmk);
-  for (t = 1; t < NTHREADS; t++)
+  for (t = 1; t < NTABLES; t++)
     pthread_join(threads[t],NULL);
 #endif
 
   //  Close input files and if user-mode then remove them
 
   p = 0;
-  for (t = 0; t < NTHREADS; t++)
+  for (t = 0; t < NTABLES; t++)
     { for (n = 0; n <= NPARTS; n++)
         close(io[p++].stream);
       free(parmk[t].oname);
     }
 
 #ifndef DEVELOPER
-  for (p = 0; p < NPARTS; p++)
-    for (t = 0; t < NTHREADS; t++)
-      { sprintf(fname,"%s/%s.%d.L%d",SORT_PATH,root,p,t);
-        unlink(fname);
-      }
+  if (CHECKPOINT == NULL)
+    for (p = 0; p < NPARTS; p++)
+      for (t = 0; t < NTABLES; t++)
+        { sprintf(fname,"%s/%s.%d.L%d",Sort_Path(p,t),root,p,t);
+          unlink(fname);
+        }
 #endif
 
   //  Turn index counts to index offsets and create stub file
@@ -492,7 +495,7 @@ void Merge_Tables(char *path, char *root)
         Clean_Exit(1);
       }
     write(f,&KMER,sizeof(int));
-    write(f,&NTHREADS,sizeof(int));
+    write(f,&NTABLES,sizeof(int));
     write(f,&DO_TABLE,sizeof(int));
     write(f,&IDX_BYTES,sizeof(int));
     if (write(f,pindex,sizeof(int64)*pidxlen) < 0)
@@ -507,14 +510,14 @@ void Merge_Tables(char *path, char *root)
     { int64 tsize;
 
       tsize = 0;
-      for (t = 0; t < NTHREADS; t++)
+      for (t = 0; t < NTABLES; t++)
         tsize += parmk[t].tsize;
 
       fprintf(stderr,"  There are ");
       Print_Number(tsize/PMER_WORD,0,stderr);
       fprintf(stderr," %d-mers that occur %d-or-more times\n",KMER,DO_TABLE);
 
-      tsize += 4*sizeof(int) + pidxlen*sizeof(int64) + NTHREADS*(sizeof(int)+sizeof(int64));
+      tsize += 4*sizeof(int) + pidxlen*sizeof(int64) + NTABLES*(sizeof(int)+sizeof(int64));
 
       if (tsize >= 5.e8)
         fprintf(stderr,"\n  The table occupies %.2f GB\n",tsize/1.e9);